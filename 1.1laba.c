@@ -1,12 +1,48 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #define MAX_LOGIN 6
-#define MAX_USERS 100
+#define MAX_COMMAND 128
+#define POOL_QUEUE_SIZE 256
+#define SESSION_INPUT (MAX_COMMAND * 2)
+#define SESSION_OUTPUT_LIMIT (64 << 10)
+#define SERVER_EVENTS 256
+#define USER_CHUNK 4096
+#define USER_TABLE_MIN 64
+#define USER_SHARD_BITS 6
+#define USER_SHARDS (1 << USER_SHARD_BITS)
+#define USER_RESERVE (1ULL << 35)
+#define USER_RESERVE_MIN (1ULL << 24)
+#define USER_CHUNK_MAX (USER_RESERVE / sizeof(User) / USER_CHUNK)
+#define DB_MAGIC "USERDB1"
+#define DB_VERSION 1
+#define DB_HEADER_SIZE 64
+#define WAL_CHECKPOINT_SIZE (64 << 20)
 
 typedef struct {
     char login[MAX_LOGIN + 1];
@@ -16,12 +52,95 @@ typedef struct {
 } User;
 
 typedef struct {
-    User users[MAX_USERS];
-    int user_count;
-    User* current_user;
+    uint64_t key;
+    uint64_t index;
+} User_slot;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+} Db_header;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    User_slot* slots;
+    size_t capacity;
+    size_t count;
+} __attribute__((aligned(64))) User_shard;
+
+typedef struct {
+    char* mapping;
+    size_t reserved;
+    Db_header* header;
+    User* records;
+    User** chunks;
+    int fd;
+    size_t count;
+    size_t allocated;
+    pthread_mutex_t add_mutex;
+    User_shard shards[USER_SHARDS];
+} User_store;
+
+typedef struct {
+    uint32_t checksum;
+    uint32_t reserved;
+    uint64_t index;
+    User user;
+} Wal_record;
+
+typedef struct {
+    int fd;
+    User_store* store;
     pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char* buffer;
+    char* spare;
+    size_t len;
+    size_t capacity;
+    size_t spare_capacity;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    off_t size;
+    int flushing;
+    int failed;
+    struct Session* waiters;
+    pthread_cond_t flush_cond;
+    pthread_t flusher;
+    int flusher_running;
+    int stop;
+} Wal;
+
+typedef struct {
+    User_store users;
+    Wal* wal;
 } Current;
 
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Output;
+
+typedef struct Command_ticket {
+    sem_t done;
+    void (*complete)(struct Command_ticket* ticket);
+} Command_ticket;
+
+typedef struct Session {
+    User* user;
+    int confirming;
+    char pending_login[MAX_LOGIN + 1];
+    int pending_limit;
+    Output* out;
+    Command_ticket* ticket;
+    uint64_t commit_lsn;
+    void (*commit_done)(struct Session* session, Output* out);
+    char commit_command[MAX_COMMAND];
+    struct Session* commit_next;
+} Session;
+
 char* strdup(const char* str) {
     if (str == NULL) {
         return NULL;
@@ -31,311 +150,2061 @@ char* strdup(const char* str) {
     if (new_str != NULL) {
         strcpy(new_str, str);
     }
-    return new_str;
+    return new_str;
+}
+
+int valid_login(const char* login) {
+    for (int i = 0; login[i] != '\0'; i++) {
+        if (!isalnum(login[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint64_t login_key(const char* login) {
+    uint64_t key = 0;
+    memcpy(&key, login, strnlen(login, MAX_LOGIN));
+    return key;
+}
+
+static size_t login_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+User* user_at(const User_store* store, size_t index) {
+    if (store->records == NULL) {
+        return &store->chunks[index / USER_CHUNK][index % USER_CHUNK];
+    }
+    return &store->records[index];
+}
+
+User_shard* user_shard(User_store* store, uint64_t key) {
+    return &store->shards[login_hash(key) >> (64 - USER_SHARD_BITS)];
+}
+
+static void user_shard_place(User_slot* slots, size_t capacity, uint64_t key, uint64_t index) {
+    size_t mask = capacity - 1;
+    size_t pos = login_hash(key) & mask;
+    while (slots[pos].key != 0) {
+        pos = (pos + 1) & mask;
+    }
+    slots[pos].key = key;
+    slots[pos].index = index;
+}
+
+static int user_shard_grow(User_shard* shard, size_t needed) {
+    size_t capacity = shard->capacity ? shard->capacity : USER_TABLE_MIN;
+    while (needed * 4 > capacity * 3) {
+        capacity *= 2;
+    }
+    if (capacity == shard->capacity) {
+        return 0;
+    }
+    User_slot* slots = calloc(capacity, sizeof(User_slot));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < shard->capacity; i++) {
+        if (shard->slots[i].key != 0) {
+            user_shard_place(slots, capacity, shard->slots[i].key, shard->slots[i].index);
+        }
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+    return 0;
+}
+
+User* user_shard_find(const User_store* store, const User_shard* shard, uint64_t key) {
+    if (shard->capacity == 0) {
+        return NULL;
+    }
+    size_t mask = shard->capacity - 1;
+    size_t pos = login_hash(key) & mask;
+    while (shard->slots[pos].key != 0) {
+        if (shard->slots[pos].key == key) {
+            return user_at(store, shard->slots[pos].index);
+        }
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+static int user_shard_insert(User_shard* shard, uint64_t key, size_t index) {
+    if (user_shard_grow(shard, shard->count + 1) != 0) {
+        return -1;
+    }
+    user_shard_place(shard->slots, shard->capacity, key, index);
+    shard->count++;
+    return 0;
+}
+
+static int user_store_reserve(User_store* store, size_t count) {
+    if (store->header == NULL) {
+        if (store->chunks == NULL) {
+            store->chunks = calloc(USER_CHUNK_MAX, sizeof(User*));
+            if (store->chunks == NULL) {
+                return -1;
+            }
+        }
+        while (store->allocated < count) {
+            size_t chunk = store->allocated / USER_CHUNK;
+            if (chunk >= USER_CHUNK_MAX) {
+                return -1;
+            }
+            store->chunks[chunk] = malloc(USER_CHUNK * sizeof(User));
+            if (store->chunks[chunk] == NULL) {
+                return -1;
+            }
+            store->allocated += USER_CHUNK;
+        }
+        return 0;
+    }
+    if (count <= store->allocated) {
+        return 0;
+    }
+
+    size_t allocated = store->allocated ? store->allocated * 2 : USER_CHUNK;
+    while (allocated < count) {
+        allocated *= 2;
+    }
+    if (DB_HEADER_SIZE + allocated * sizeof(User) > store->reserved) {
+        allocated = (store->reserved - DB_HEADER_SIZE) / sizeof(User);
+        if (allocated < count) {
+            return -1;
+        }
+    }
+    if (ftruncate(store->fd, DB_HEADER_SIZE + allocated * sizeof(User)) != 0) {
+        return -1;
+    }
+    store->allocated = allocated;
+    return 0;
+}
+
+void user_store_init(User_store* store) {
+    memset(store, 0, sizeof(User_store));
+    store->fd = -1;
+    pthread_mutex_init(&store->add_mutex, NULL);
+    for (int i = 0; i < USER_SHARDS; i++) {
+        pthread_mutex_init(&store->shards[i].mutex, NULL);
+    }
+}
+
+size_t user_store_limit(const User_store* store) {
+    if (store->header == NULL) {
+        return USER_CHUNK_MAX * USER_CHUNK;
+    }
+    return (store->reserved - DB_HEADER_SIZE) / sizeof(User);
+}
+
+static int user_store_index(User_store* store, size_t index) {
+    uint64_t key = login_key(user_at(store, index)->login);
+    if (key == 0) {
+        return 0;
+    }
+    User_shard* shard = user_shard(store, key);
+    if (user_shard_find(store, shard, key) != NULL) {
+        return 0;
+    }
+    return user_shard_insert(shard, key, index);
+}
+
+int user_store_open(User_store* store, const char* path) {
+    user_store_init(store);
+    store->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (store->fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(store->fd, &st) != 0) {
+        close(store->fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        Db_header header = {0};
+        memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+        header.version = DB_VERSION;
+        header.record_size = sizeof(User);
+        if (ftruncate(store->fd, DB_HEADER_SIZE) != 0 ||
+            pwrite(store->fd, &header, sizeof(header), 0) != sizeof(header) || fsync(store->fd) != 0) {
+            close(store->fd);
+            return -1;
+        }
+        st.st_size = DB_HEADER_SIZE;
+    }
+
+    size_t reserved = USER_RESERVE;
+    void* mapping = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, store->fd, 0);
+    while (mapping == MAP_FAILED && reserved / 2 >= USER_RESERVE_MIN && reserved / 2 >= (size_t)st.st_size) {
+        reserved /= 2;
+        mapping = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, store->fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        close(store->fd);
+        return -1;
+    }
+    store->mapping = mapping;
+    store->reserved = reserved;
+    store->header = (Db_header*)mapping;
+    store->records = (User*)(store->mapping + DB_HEADER_SIZE);
+    store->allocated = st.st_size < DB_HEADER_SIZE ? 0 : (st.st_size - DB_HEADER_SIZE) / sizeof(User);
+
+    if (st.st_size < DB_HEADER_SIZE || memcmp(store->header->magic, DB_MAGIC, sizeof(store->header->magic)) != 0 ||
+        store->header->version != DB_VERSION || store->header->record_size != sizeof(User) ||
+        store->header->count > store->allocated) {
+        munmap(store->mapping, store->reserved);
+        close(store->fd);
+        memset(store, 0, sizeof(User_store));
+        return -1;
+    }
+
+    store->count = store->header->count;
+    for (int i = 0; i < USER_SHARDS; i++) {
+        if (user_shard_grow(&store->shards[i], store->count / USER_SHARDS + 1) != 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < store->count; i++) {
+        if (user_store_index(store, i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+User* user_store_find(User_store* store, const char* login) {
+    uint64_t key = login_key(login);
+    User_shard* shard = user_shard(store, key);
+    pthread_mutex_lock(&shard->mutex);
+    User* user = user_shard_find(store, shard, key);
+    pthread_mutex_unlock(&shard->mutex);
+    return user;
+}
+
+User* user_shard_add(User_store* store, User_shard* shard, const char* login, int pin) {
+    pthread_mutex_lock(&store->add_mutex);
+    if (user_store_reserve(store, store->count + 1) != 0) {
+        pthread_mutex_unlock(&store->add_mutex);
+        return NULL;
+    }
+    size_t index = store->count;
+    User* user = user_at(store, index);
+    memset(user, 0, sizeof(User));
+    memcpy(user->login, login, strnlen(login, MAX_LOGIN));
+    user->pin = pin;
+    user->request_limit = -1;
+    user->request_count = 0;
+    store->count++;
+    if (store->header) {
+        store->header->count = store->count;
+    }
+    pthread_mutex_unlock(&store->add_mutex);
+
+    if (user_shard_insert(shard, login_key(login), index) != 0) {
+        return NULL;
+    }
+    return user;
+}
+
+User* user_store_add(User_store* store, const char* login, int pin) {
+    uint64_t key = login_key(login);
+    User_shard* shard = user_shard(store, key);
+    pthread_mutex_lock(&shard->mutex);
+    User* user = user_shard_find(store, shard, key) == NULL ? user_shard_add(store, shard, login, pin) : NULL;
+    pthread_mutex_unlock(&shard->mutex);
+    return user;
+}
+
+int user_store_put(User_store* store, size_t index, const User* user) {
+    if (user_store_reserve(store, index + 1) != 0) {
+        return -1;
+    }
+    *user_at(store, index) = *user;
+    if (index >= store->count) {
+        store->count = index + 1;
+        if (store->header) {
+            store->header->count = store->count;
+        }
+    }
+    return user_store_index(store, index);
+}
+
+int user_store_sync(User_store* store) {
+    if (store->header == NULL) {
+        return 0;
+    }
+    if (msync(store->mapping, DB_HEADER_SIZE + store->count * sizeof(User), MS_SYNC) != 0) {
+        return -1;
+    }
+    return fsync(store->fd);
+}
+
+void user_store_free(User_store* store) {
+    if (store->mapping != NULL) {
+        munmap(store->mapping, store->reserved);
+    }
+    if (store->chunks != NULL) {
+        for (size_t i = 0; i < store->allocated / USER_CHUNK; i++) {
+            free(store->chunks[i]);
+        }
+        free(store->chunks);
+    }
+    if (store->header != NULL) {
+        close(store->fd);
+    }
+    for (int i = 0; i < USER_SHARDS; i++) {
+        free(store->shards[i].slots);
+        pthread_mutex_destroy(&store->shards[i].mutex);
+    }
+    pthread_mutex_destroy(&store->add_mutex);
+    memset(store, 0, sizeof(User_store));
+}
+
+int user_try_request(User* user) {
+    int count = __atomic_load_n(&user->request_count, __ATOMIC_RELAXED);
+    do {
+        int limit = __atomic_load_n(&user->request_limit, __ATOMIC_RELAXED);
+        if (limit != -1 && count >= limit) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&user->request_count, &count, count + 1, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return 1;
+}
+
+int user_limit_reached(User* user) {
+    int limit = __atomic_load_n(&user->request_limit, __ATOMIC_RELAXED);
+    return limit != -1 && __atomic_load_n(&user->request_count, __ATOMIC_RELAXED) >= limit;
+}
+
+static uint32_t wal_checksum(const Wal_record* record) {
+    const unsigned char* data = (const unsigned char*)&record->index;
+    size_t len = sizeof(Wal_record) - offsetof(Wal_record, index);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+Wal* wal_open(const char* path, User_store* store, size_t* replayed) {
+    Wal* wal = calloc(1, sizeof(Wal));
+    if (wal == NULL) {
+        return NULL;
+    }
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (wal->fd == -1) {
+        free(wal);
+        return NULL;
+    }
+
+    *replayed = 0;
+    off_t valid = 0;
+    Wal_record record;
+    while (pread(wal->fd, &record, sizeof(record), valid) == sizeof(record) &&
+           record.checksum == wal_checksum(&record)) {
+        if (user_store_put(store, record.index, &record.user) != 0) {
+            break;
+        }
+        valid += sizeof(record);
+        (*replayed)++;
+    }
+
+    if (user_store_sync(store) != 0 || ftruncate(wal->fd, 0) != 0 || fsync(wal->fd) != 0) {
+        close(wal->fd);
+        free(wal);
+        return NULL;
+    }
+
+    wal->store = store;
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+    pthread_cond_init(&wal->flush_cond, NULL);
+    return wal;
+}
+
+static int wal_checkpoint_locked(Wal* wal) {
+    uint64_t target = wal->next_lsn;
+    wal->len = 0;
+    wal->flushing = 1;
+    pthread_mutex_unlock(&wal->mutex);
+
+    int status = user_store_sync(wal->store) == 0 && ftruncate(wal->fd, 0) == 0 && fsync(wal->fd) == 0 ? 0 : -1;
+
+    pthread_mutex_lock(&wal->mutex);
+    wal->flushing = 0;
+    if (status == 0) {
+        wal->size = 0;
+        wal->failed = 0;
+        if (wal->durable_lsn < target) {
+            wal->durable_lsn = target;
+        }
+    } else {
+        wal->failed = 1;
+    }
+    pthread_cond_broadcast(&wal->cond);
+    return status;
+}
+
+uint64_t wal_append(Wal* wal, const User_store* store, const User* user) {
+    Wal_record record = {0};
+    record.index = user - store->records;
+    memcpy(record.user.login, user->login, sizeof(record.user.login));
+    record.user.pin = user->pin;
+    record.user.request_limit = __atomic_load_n(&user->request_limit, __ATOMIC_RELAXED);
+    record.user.request_count = __atomic_load_n(&user->request_count, __ATOMIC_RELAXED);
+    record.checksum = wal_checksum(&record);
+
+    pthread_mutex_lock(&wal->mutex);
+    if (wal->len + sizeof(record) > wal->capacity) {
+        size_t capacity = wal->capacity ? wal->capacity * 2 : 4096;
+        while (capacity < wal->len + sizeof(record)) {
+            capacity *= 2;
+        }
+        char* buffer = realloc(wal->buffer, capacity);
+        if (buffer == NULL) {
+            wal->failed = 1;
+            uint64_t lsn = ++wal->next_lsn;
+            pthread_mutex_unlock(&wal->mutex);
+            return lsn;
+        }
+        wal->buffer = buffer;
+        wal->capacity = capacity;
+    }
+    memcpy(wal->buffer + wal->len, &record, sizeof(record));
+    wal->len += sizeof(record);
+    uint64_t lsn = ++wal->next_lsn;
+    pthread_mutex_unlock(&wal->mutex);
+    return lsn;
+}
+
+int wal_commit(Wal* wal, uint64_t lsn) {
+    int status = 0;
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->durable_lsn < lsn) {
+        if (wal->flushing) {
+            pthread_cond_wait(&wal->cond, &wal->mutex);
+            continue;
+        }
+        if (wal->failed) {
+            status = wal_checkpoint_locked(wal);
+            if (status != 0) {
+                break;
+            }
+            continue;
+        }
+
+        char* batch = wal->buffer;
+        size_t batch_capacity = wal->capacity;
+        size_t len = wal->len;
+        uint64_t target = wal->next_lsn;
+        wal->buffer = wal->spare;
+        wal->capacity = wal->spare_capacity;
+        wal->len = 0;
+        wal->flushing = 1;
+        pthread_mutex_unlock(&wal->mutex);
+
+        int written = write_all(wal->fd, batch, len) == 0 && fdatasync(wal->fd) == 0;
+
+        pthread_mutex_lock(&wal->mutex);
+        wal->spare = batch;
+        wal->spare_capacity = batch_capacity;
+        wal->flushing = 0;
+        if (written) {
+            wal->durable_lsn = target;
+            wal->size += len;
+        } else {
+            wal->failed = 1;
+        }
+        pthread_cond_broadcast(&wal->cond);
+    }
+    if (status == 0 && !wal->flushing && wal->size >= WAL_CHECKPOINT_SIZE) {
+        wal_checkpoint_locked(wal);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+    return status;
+}
+
+int wal_defer(Wal* wal, Session* session, uint64_t lsn) {
+    pthread_mutex_lock(&wal->mutex);
+    if (!wal->flusher_running || wal->durable_lsn >= lsn) {
+        pthread_mutex_unlock(&wal->mutex);
+        return 0;
+    }
+    session->commit_lsn = lsn;
+    session->commit_next = wal->waiters;
+    wal->waiters = session;
+    pthread_cond_signal(&wal->flush_cond);
+    pthread_mutex_unlock(&wal->mutex);
+    return 1;
+}
+
+void wal_close(Wal* wal) {
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->flushing) {
+        pthread_cond_wait(&wal->cond, &wal->mutex);
+    }
+    wal_checkpoint_locked(wal);
+    pthread_mutex_unlock(&wal->mutex);
+    close(wal->fd);
+    pthread_mutex_destroy(&wal->mutex);
+    pthread_cond_destroy(&wal->cond);
+    pthread_cond_destroy(&wal->flush_cond);
+    free(wal->buffer);
+    free(wal->spare);
+    free(wal);
+}
+
+void reply(Output* out, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (out == NULL) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    char buffer[512];
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= sizeof(buffer)) {
+        len = sizeof(buffer) - 1;
+    }
+    if (out->len + len > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 256;
+        while (capacity < out->len + len) {
+            capacity *= 2;
+        }
+        char* data = realloc(out->data, capacity);
+        if (data == NULL) {
+            return;
+        }
+        out->data = data;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->len, buffer, len);
+    out->len += len;
+}
+
+uint64_t user_log_locked(Current* state, const User* user) {
+    if (state->wal == NULL) {
+        return 0;
+    }
+    return wal_append(state->wal, &state->users, user);
+}
+
+uint64_t user_log(Current* state, const User* user) {
+    if (state->wal == NULL) {
+        return 0;
+    }
+    User_shard* shard = user_shard(&state->users, login_key(user->login));
+    pthread_mutex_lock(&shard->mutex);
+    uint64_t lsn = user_log_locked(state, user);
+    pthread_mutex_unlock(&shard->mutex);
+    return lsn;
+}
+
+static void commit_complete(Session* session, Output* out, void (*done)(Session*, Output*), int status) {
+    if (status != 0) {
+        reply(out, "Ошибка записи журнала. Изменение будет сохранено при следующей записи.\n");
+        return;
+    }
+    done(session, out);
+}
+
+int user_commit(Current* state, Session* session, Output* out, uint64_t lsn,
+                void (*done)(Session*, Output*)) {
+    if (state->wal != NULL && session != NULL && session->ticket != NULL && session->ticket->complete != NULL) {
+        session->commit_done = done;
+        if (wal_defer(state->wal, session, lsn)) {
+            return 1;
+        }
+    }
+    int status = state->wal != NULL ? wal_commit(state->wal, lsn) : 0;
+    commit_complete(session, out, done, status);
+    return status;
+}
+
+static void* commit_flusher(void* arg) {
+    Current* state = (Current*)arg;
+    Wal* wal = state->wal;
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->waiters != NULL || !wal->stop) {
+        if (wal->waiters == NULL) {
+            pthread_cond_wait(&wal->flush_cond, &wal->mutex);
+            continue;
+        }
+        uint64_t target = wal->next_lsn;
+        pthread_mutex_unlock(&wal->mutex);
+        int status = wal_commit(wal, target);
+        pthread_mutex_lock(&wal->mutex);
+
+        Session* ready = NULL;
+        Session** link = &wal->waiters;
+        while (*link != NULL) {
+            Session* session = *link;
+            if (session->commit_lsn <= (status == 0 ? wal->durable_lsn : target)) {
+                *link = session->commit_next;
+                session->commit_next = ready;
+                ready = session;
+            } else {
+                link = &session->commit_next;
+            }
+        }
+        pthread_mutex_unlock(&wal->mutex);
+
+        while (ready != NULL) {
+            Session* session = ready;
+            ready = session->commit_next;
+            Command_ticket* ticket = session->ticket;
+            commit_complete(session, session->out, session->commit_done, status);
+            ticket->complete(ticket);
+        }
+        pthread_mutex_lock(&wal->mutex);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+    return NULL;
+}
+
+int commit_flusher_start(Current* state) {
+    if (state->wal == NULL) {
+        return 0;
+    }
+    state->wal->stop = 0;
+    if (pthread_create(&state->wal->flusher, NULL, commit_flusher, state) != 0) {
+        return -1;
+    }
+    state->wal->flusher_running = 1;
+    return 0;
+}
+
+void commit_flusher_stop(Current* state) {
+    if (state->wal == NULL || !state->wal->flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&state->wal->mutex);
+    state->wal->stop = 1;
+    pthread_cond_signal(&state->wal->flush_cond);
+    pthread_mutex_unlock(&state->wal->mutex);
+    pthread_join(state->wal->flusher, NULL);
+    state->wal->flusher_running = 0;
+}
+
+static void register_done(Session* session, Output* out) {
+    (void)session;
+    reply(out, "Пользователь успешно зарегистрирован.\n");
+}
+
+int register_user(Current* state, Session* session, const char* login, int pin) {
+    Output* out = session != NULL ? session->out : NULL;
+    if (!valid_login(login)) {
+        reply(out, "Логин должен содержать только латинские буквы и цифры.\n");
+        return -1;
+    }
+    if (pin < 0 || pin > 100000) {
+        reply(out, "Некорректный PIN-код. Допустимый диапазон: от 0 до 100000.\n");
+        return -1;
+    }
+
+    uint64_t key = login_key(login);
+    User_shard* shard = user_shard(&state->users, key);
+    pthread_mutex_lock(&shard->mutex);
+    if (user_shard_find(&state->users, shard, key) != NULL) {
+        pthread_mutex_unlock(&shard->mutex);
+        reply(out, "Пользователь с таким логином уже существует.\n");
+        return -1;
+    }
+
+    User* user = user_shard_add(&state->users, shard, login, pin);
+    if (user == NULL) {
+        pthread_mutex_unlock(&shard->mutex);
+        size_t limit = user_store_limit(&state->users);
+        if (__atomic_load_n(&state->users.count, __ATOMIC_RELAXED) >= limit) {
+            reply(out, "Достигнут предел базы пользователей: %zu записей.\n", limit);
+        } else {
+            reply(out, "Ошибка выделения памяти.\n");
+        }
+        return -1;
+    }
+    uint64_t lsn = user_log_locked(state, user);
+    pthread_mutex_unlock(&shard->mutex);
+
+    return user_commit(state, session, out, lsn, register_done);
+}
+
+int authorize_user(Current* state, Session* session, const char* login, int pin) {
+    User* user = user_store_find(&state->users, login);
+
+    if (user == NULL) {
+        reply(session->out, "Пользователь с таким логином не найден.\n");
+        return -1;
+    }
+    if (user->pin != pin) {
+        reply(session->out, "Неверный PIN-код.\n");
+        return -1;
+    }
+    session->user = user;
+    reply(session->out, "Добро пожаловать, %s!\n", user->login);
+    return 0;
+}
+
+void registration(Current* state) {
+    char login[MAX_LOGIN + 1];
+    int pin;
+
+    printf("Регистрация нового пользователя\n");
+    printf("Введите логин (не более 6 символов, только латинские буквы и цифры): ");
+    
+    if (scanf("%6s", login) != 1) {
+        printf("Ошибка ввода логина.\n");
+        while (getchar() != '\n'); 
+        return;
+    }
+
+    if (!valid_login(login)) {
+        printf("Логин должен содержать только латинские буквы и цифры.\n");
+        return;
+    }
+
+    int exists = user_store_find(&state->users, login) != NULL;
+    if (exists) {
+        printf("Пользователь с таким логином уже существует.\n");
+        return;
+    }
+
+    printf("Введите PIN-код (число от 0 до 100000): ");
+    if (scanf("%d", &pin) != 1) {
+        printf("Ошибка ввода PIN-кода.\n");
+        while (getchar() != '\n');
+        return;
+    }
+
+    register_user(state, NULL, login, pin);
+}
+
+void authorization(Current* state, Session* session) {
+    char login[MAX_LOGIN + 1];
+    int pin;
+
+    printf("Авторизация\n");
+    printf("Введите логин: ");
+    if (scanf("%6s", login) != 1) {
+        printf("Ошибка ввода логина.\n");
+        while (getchar() != '\n'); 
+        return;
+    }
+
+    int exists = user_store_find(&state->users, login) != NULL;
+    if (!exists) {
+        printf("Пользователь с таким логином не найден.\n");
+        return;
+    }
+
+    printf("Введите PIN-код: ");
+    if (scanf("%d", &pin) != 1) {
+        printf("Ошибка ввода PIN-кода.\n");
+        while (getchar() != '\n'); 
+        return;
+    }
+
+    while (getchar() != '\n');
+
+    authorize_user(state, session, login, pin);
+}
+
+void logout(Session* session) {
+    session->user = NULL;
+    reply(session->out, "Вы вышли из системы.\n");
+}
+
+void get_time(Output* out) {
+    time_t now = time(NULL);
+    if (now == -1) {
+        reply(out, "Ошибка при получении времени.\n");
+        return;
+    }
+
+    struct tm tm_buf;
+    struct tm *tm = localtime_r(&now, &tm_buf);
+    if (tm == NULL) {
+        reply(out, "Ошибка при преобразовании времени.\n");
+        return;
+    }
+
+    reply(out, "Текущее время: %02d:%02d:%02d\n", tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
+
+void get_date(Output* out) {
+    time_t now = time(NULL);
+    if (now == -1) {
+        reply(out, "Ошибка при получении времени.\n");
+        return;
+    }
+
+    struct tm tm_buf;
+    struct tm *tm = localtime_r(&now, &tm_buf);
+    if (tm == NULL) {
+        reply(out, "Ошибка при преобразовании времени.\n");
+        return;
+    }
+
+    reply(out, "Текущая дата: %02d:%02d:%04d\n", tm->tm_mday, tm->tm_mon + 1, tm->tm_year + 1900);
+}
+
+void howmuch(const char *time_str, const char *flag, Output* out) {
+    struct tm time_in = {0}; 
+    int day, month, year;
+
+    if (sscanf(time_str, "%d:%d:%d", &day, &month, &year) != 3) {
+        reply(out, "Некорректный формат даты. Используйте формат дд:мм:гггг.\n");
+        return;
+    }
+
+    if (day < 1 || day > 31 || month < 1 || month > 12 || year < 1900) {
+        reply(out, "Некорректная дата. Проверьте введённые значения.\n");
+        return;
+    }
+
+    time_in.tm_mday = day;
+    time_in.tm_mon = month - 1;  
+    time_in.tm_year = year - 1900; 
+
+    time_t first = mktime(&time_in);
+    if (first == -1) {
+        reply(out, "Ошибка при разборе даты.\n");
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now == -1) {
+        reply(out, "Ошибка при получении текущего времени.\n");
+        return;
+    }
+
+    double res = difftime(now, first);
+
+    if (strcmp(flag, "-s") == 0) {
+        reply(out, "Прошло секунд: %.0f\n", res); 
+    } else if (strcmp(flag, "-m") == 0) {
+        reply(out, "Прошло минут: %.0f\n", res / 60); 
+    } else if (strcmp(flag, "-h") == 0) {
+        reply(out, "Прошло часов: %.0f\n", res / 3600); 
+    } else if (strcmp(flag, "-y") == 0) {
+        reply(out, "Прошло лет: %.0f\n", res / (3600 * 24 * 365)); 
+    } else {
+        reply(out, "Некорректный флаг. Допустимые флаги: -s, -m, -h, -y.\n");
+    }
+}
+
+void set_sanctions(Session* session, const char *username, int number) {
+    if (number < 0) {
+        reply(session->out, "Число должно быть неотрицательным.\n");
+        return;
+    }
+
+    strcpy(session->pending_login, username);
+    session->pending_limit = number;
+    session->confirming = 1;
+    reply(session->out, session->out == NULL ? "Введите 12345 для подтверждения: "
+                                             : "Введите 12345 для подтверждения:\n");
+}
+
+static void sanctions_done(Session* session, Output* out) {
+    reply(out, "Для пользователя %s установлено ограничение в %d запросов.\n",
+          session->pending_login, session->pending_limit);
+}
+
+int confirm_sanctions(Current* state, Session* session, const char* line) {
+    session->confirming = 0;
+
+    char confirmation[6];
+    if (sscanf(line, "%5s", confirmation) != 1) {
+        reply(session->out, "Ошибка ввода подтверждения.\n");
+        return 0;
+    }
+
+    if (strcmp(confirmation, "12345") != 0) {
+        reply(session->out, "Подтверждение не удалось.\n");
+        return 0;
+    }
+
+    uint64_t key = login_key(session->pending_login);
+    User_shard* shard = user_shard(&state->users, key);
+    pthread_mutex_lock(&shard->mutex);
+    User* user = user_shard_find(&state->users, shard, key);
+    if (user != NULL) {
+        __atomic_store_n(&user->request_limit, session->pending_limit, __ATOMIC_RELAXED);
+        uint64_t lsn = user_log_locked(state, user);
+        pthread_mutex_unlock(&shard->mutex);
+        return user_commit(state, session, session->out, lsn, sanctions_done) > 0;
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+    reply(session->out, "Пользователь с логином %s не найден.\n", session->pending_login);
+    return 0;
+}
+
+typedef struct {
+    Current* state;
+    Session* session;
+    char* command;
+} Thread_args;
+
+static void command_done(Session* session, Output* out) {
+    const char* command = session->commit_command;
+    if (strcmp(command, "Time") == 0) {
+        get_time(out);
+    } else if (strcmp(command, "Date") == 0) {
+        get_date(out);
+    } else if (strncmp(command, "Howmuch", 7) == 0) {
+        char time_str[11];
+        char flag[3];
+        if (sscanf(command, "Howmuch %10s %2s", time_str, flag) == 2) {
+            howmuch(time_str, flag, out);
+        } else {
+            reply(out, "Некорректный формат команды. Используйте: <Howmuch> <дд:мм:гггг> <-флаг>.\n");
+        }
+    } else if (strcmp(command, "Logout") == 0) {
+        logout(session);
+    } else if (strncmp(command, "Sanctions", 9) == 0) {
+        char username[MAX_LOGIN + 1];
+        int number;
+
+        if (sscanf(command, "Sanctions %6s %d", username, &number) == 2) {
+            set_sanctions(session, username, number);
+        } else {
+            reply(out, "Некорректный формат команды. Используйте: <Sanctions> <логин> <число>.\n");
+        }
+    } else {
+        reply(out, "Некорректная команда.\n");
+    }
+}
+
+int execute_command(Current* state, Session* session, const char* command) {
+    if (session->user == NULL) {
+        reply(session->out, "Пользователь не авторизован.\n");
+        return 0;
+    }
+
+    if (!user_try_request(session->user)) {
+        reply(session->out, "Превышено количество запросов.\n");
+        logout(session);
+        return 0;
+    }
+
+    uint64_t lsn = user_log(state, session->user);
+    strncpy(session->commit_command, command, MAX_COMMAND - 1);
+    session->commit_command[MAX_COMMAND - 1] = '\0';
+    return user_commit(state, session, session->out, lsn, command_done) > 0;
+}
+
+int session_command(Current* state, Session* session, const char* line) {
+    if (session->confirming) {
+        return confirm_sanctions(state, session, line);
+    }
+
+    if (session->user == NULL) {
+        char login[MAX_LOGIN + 1];
+        int pin;
+        if (sscanf(line, "Login %6s %d", login, &pin) == 2) {
+            authorize_user(state, session, login, pin);
+        } else if (sscanf(line, "Register %6s %d", login, &pin) == 2) {
+            return register_user(state, session, login, pin) > 0;
+        } else {
+            reply(session->out, "Пользователь не авторизован. Используйте: <Login> <логин> <PIN> "
+                                "или <Register> <логин> <PIN>.\n");
+        }
+        return 0;
+    }
+
+    return execute_command(state, session, line);
+}
+
+void* process_command_thread(void* arg) {
+    Thread_args* args = (Thread_args*)arg;
+    execute_command(args->state, args->session, args->command);
+    free(args->command);
+    free(args);
+    pthread_exit(NULL);
+}
+
+typedef struct {
+    size_t sequence;
+    Command_ticket* ticket;
+    Session* session;
+    char command[MAX_COMMAND];
+} Command_slot;
+
+typedef struct {
+    Current* state;
+    Command_slot slots[POOL_QUEUE_SIZE];
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    sem_t items __attribute__((aligned(64)));
+    pthread_t* threads;
+    int thread_count;
+} Worker_pool;
+
+static int pool_try_enqueue(Worker_pool* pool, Session* session, const char* command, Command_ticket* ticket) {
+    Command_slot* slot;
+    size_t pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        slot = &pool->slots[pos & (POOL_QUEUE_SIZE - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->ticket = ticket;
+    slot->session = session;
+    strncpy(slot->command, command, MAX_COMMAND - 1);
+    slot->command[MAX_COMMAND - 1] = '\0';
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&pool->items);
+    return 0;
+}
+
+static void pool_enqueue(Worker_pool* pool, Session* session, const char* command, Command_ticket* ticket) {
+    while (pool_try_enqueue(pool, session, command, ticket) != 0) {
+        sched_yield();
+    }
+}
+
+static Command_slot* pool_dequeue(Worker_pool* pool, size_t* pos_out) {
+    size_t pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        Command_slot* slot = &pool->slots[pos & (POOL_QUEUE_SIZE - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            sched_yield();
+            pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void* pool_worker(void* arg) {
+    Worker_pool* pool = (Worker_pool*)arg;
+    while (1) {
+        while (sem_wait(&pool->items) != 0);
+
+        size_t pos;
+        Command_slot* slot = pool_dequeue(pool, &pos);
+        Command_ticket* ticket = slot->ticket;
+        int deferred = 0;
+        if (ticket != NULL) {
+            deferred = session_command(pool->state, slot->session, slot->command);
+        }
+        __atomic_store_n(&slot->sequence, pos + POOL_QUEUE_SIZE, __ATOMIC_RELEASE);
+
+        if (ticket == NULL) {
+            return NULL;
+        }
+        if (deferred) {
+            continue;
+        }
+        if (ticket->complete != NULL) {
+            ticket->complete(ticket);
+        } else {
+            sem_post(&ticket->done);
+        }
+    }
+}
+
+int pool_init(Worker_pool* pool, Current* state, int thread_count) {
+    memset(pool, 0, sizeof(Worker_pool));
+    pool->state = state;
+    for (size_t i = 0; i < POOL_QUEUE_SIZE; i++) {
+        pool->slots[i].sequence = i;
+    }
+    sem_init(&pool->items, 0, 0);
+
+    pool->threads = malloc(thread_count * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+            break;
+        }
+        pool->thread_count++;
+    }
+    return pool->thread_count > 0 ? 0 : -1;
+}
+
+void pool_run(Worker_pool* pool, Session* session, const char* command, Command_ticket* ticket) {
+    pool_enqueue(pool, session, command, ticket);
+    while (sem_wait(&ticket->done) != 0);
+}
+
+void pool_destroy(Worker_pool* pool) {
+    for (int i = 0; i < pool->thread_count; i++) {
+        pool_enqueue(pool, NULL, "", NULL);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    sem_destroy(&pool->items);
+}
+
+typedef struct Server Server;
+
+typedef struct Server_session {
+    Command_ticket ticket;
+    Session session;
+    Server* server;
+    int fd;
+    int busy;
+    int ready;
+    int eof;
+    int closing;
+    uint32_t events;
+    char input[SESSION_INPUT];
+    size_t input_len;
+    Output reply;
+    Output send;
+    size_t sent;
+    struct Server_session* next_done;
+    struct Server_session* ready_prev;
+    struct Server_session* ready_next;
+    struct Server_session* prev;
+    struct Server_session* next;
+} Server_session;
+
+struct Server {
+    Current* state;
+    Worker_pool* pool;
+    int epoll_fd;
+    int listen_fd;
+    int event_fd;
+    int signal_fd;
+    int accept_paused;
+    pthread_mutex_t mutex;
+    Server_session* done;
+    Server_session* ready_head;
+    Server_session* ready_tail;
+    Server_session* closed;
+    Server_session* sessions;
+    size_t session_count;
+};
+
+static void server_complete(Command_ticket* ticket) {
+    Server_session* session = (Server_session*)ticket;
+    Server* server = session->server;
+    pthread_mutex_lock(&server->mutex);
+    session->next_done = server->done;
+    server->done = session;
+    pthread_mutex_unlock(&server->mutex);
+
+    uint64_t one = 1;
+    while (write(server->event_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void server_watch(Server* server, int fd, void* ptr, uint32_t events, int op) {
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = ptr;
+    epoll_ctl(server->epoll_fd, op, fd, &event);
+}
+
+static void session_ready_push(Server* server, Server_session* session) {
+    session->ready = 1;
+    session->ready_next = NULL;
+    session->ready_prev = server->ready_tail;
+    if (server->ready_tail != NULL) {
+        server->ready_tail->ready_next = session;
+    } else {
+        server->ready_head = session;
+    }
+    server->ready_tail = session;
+}
+
+static void session_ready_remove(Server* server, Server_session* session) {
+    if (session->ready_prev != NULL) {
+        session->ready_prev->ready_next = session->ready_next;
+    } else {
+        server->ready_head = session->ready_next;
+    }
+    if (session->ready_next != NULL) {
+        session->ready_next->ready_prev = session->ready_prev;
+    } else {
+        server->ready_tail = session->ready_prev;
+    }
+    session->ready = 0;
+    session->ready_prev = NULL;
+    session->ready_next = NULL;
+}
+
+static void session_free(Server* server, Server_session* session) {
+    if (session->ready) {
+        session_ready_remove(server, session);
+    }
+    if (session->prev != NULL) {
+        session->prev->next = session->next;
+    } else {
+        server->sessions = session->next;
+    }
+    if (session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    server->session_count--;
+    session->prev = NULL;
+    session->next = server->closed;
+    server->closed = session;
+
+    if (server->accept_paused) {
+        server->accept_paused = 0;
+        server_watch(server, server->listen_fd, &server->listen_fd, EPOLLIN, EPOLL_CTL_MOD);
+    }
+}
+
+static void server_free_closed(Server* server) {
+    while (server->closed != NULL) {
+        Server_session* session = server->closed;
+        server->closed = session->next;
+        free(session->reply.data);
+        free(session->send.data);
+        free(session);
+    }
+}
+
+static void session_close(Server* server, Server_session* session) {
+    if (session->fd != -1) {
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        close(session->fd);
+        session->fd = -1;
+    }
+    if (session->busy) {
+        session->closing = 1;
+        return;
+    }
+    session_free(server, session);
+}
+
+static void output_append(Output* out, const char* data, size_t len) {
+    if (out->len + len > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 256;
+        while (capacity < out->len + len) {
+            capacity *= 2;
+        }
+        char* grown = realloc(out->data, capacity);
+        if (grown == NULL) {
+            return;
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+static int session_flush(Server* server, Server_session* session) {
+    while (session->sent < session->send.len) {
+        ssize_t written = send(session->fd, session->send.data + session->sent,
+                               session->send.len - session->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            session_close(server, session);
+            return -1;
+        }
+        session->sent += written;
+    }
+    session->send.len = 0;
+    session->sent = 0;
+    return 0;
 }
 
-int valid_login(const char* login) {
-    for (int i = 0; login[i] != '\0'; i++) {
-        if (!isalnum(login[i])) {
-            return 0;
+static void session_dispatch(Server* server, Server_session* session) {
+    while (!session->busy && session->send.len - session->sent < SESSION_OUTPUT_LIMIT) {
+        char* newline = memchr(session->input, '\n', session->input_len);
+        if (newline == NULL) {
+            if (session->input_len == SESSION_INPUT) {
+                static const char message[] = "Слишком длинная команда.\n";
+                output_append(&session->send, message, sizeof(message) - 1);
+                session->input_len = 0;
+                session->eof = 1;
+            }
+            return;
+        }
+
+        size_t line_len = newline - session->input;
+        char line[SESSION_INPUT];
+        memcpy(line, session->input, line_len);
+        line[line_len] = '\0';
+        line[strcspn(line, "\r")] = '\0';
+
+        if (line[0] != '\0') {
+            if ((server->ready_head != NULL && server->ready_head != session) ||
+                pool_try_enqueue(server->pool, &session->session, line, &session->ticket) != 0) {
+                if (!session->ready) {
+                    session_ready_push(server, session);
+                }
+                return;
+            }
+            if (session->ready) {
+                session_ready_remove(server, session);
+            }
+            session->busy = 1;
         }
+        session->input_len -= line_len + 1;
+        memmove(session->input, newline + 1, session->input_len);
     }
-    return 1;
 }
 
-void registration(Current* state) {
-    pthread_mutex_lock(&state->mutex);
-    if (state->user_count >= MAX_USERS) {
-        printf("Достигнуто максимальное количество пользователей.\n");
-        pthread_mutex_unlock(&state->mutex);
+static void session_update(Server* server, Server_session* session) {
+    if (session_flush(server, session) != 0) {
         return;
     }
-
-    char login[MAX_LOGIN + 1];
-    int pin;
-
-    printf("Регистрация нового пользователя\n");
-    printf("Введите логин (не более 6 символов, только латинские буквы и цифры): ");
-    
-    if (scanf("%6s", login) != 1) {
-        printf("Ошибка ввода логина.\n");
-        while (getchar() != '\n'); 
-        pthread_mutex_unlock(&state->mutex);
+    if (session->eof && !session->busy && session->send.len == 0 &&
+        memchr(session->input, '\n', session->input_len) == NULL) {
+        session_close(server, session);
         return;
     }
 
-    if (!valid_login(login)) {
-        printf("Логин должен содержать только латинские буквы и цифры.\n");
-        pthread_mutex_unlock(&state->mutex);
-        return;
+    uint32_t events = 0;
+    if (!session->busy && !session->ready && !session->eof && session->send.len < SESSION_OUTPUT_LIMIT) {
+        events |= EPOLLIN;
+    }
+    if (session->send.len > 0) {
+        events |= EPOLLOUT;
     }
+    if (events != session->events) {
+        session->events = events;
+        server_watch(server, session->fd, session, events, EPOLL_CTL_MOD);
+    }
+}
 
-    for (int i = 0; i < state->user_count; i++) {
-        if (strcmp(state->users[i].login, login) == 0) {
-            printf("Пользователь с таким логином уже существует.\n");
-            pthread_mutex_unlock(&state->mutex);
+static void server_dispatch_ready(Server* server) {
+    while (server->ready_head != NULL) {
+        Server_session* session = server->ready_head;
+        session_dispatch(server, session);
+        session_update(server, session);
+        if (server->ready_head == session) {
             return;
         }
     }
+}
 
-    printf("Введите PIN-код (число от 0 до 100000): ");
-    if (scanf("%d", &pin) != 1) {
-        printf("Ошибка ввода PIN-кода.\n");
-        while (getchar() != '\n');
-        pthread_mutex_unlock(&state->mutex);
+static void session_read(Server* server, Server_session* session) {
+    while (session->input_len < SESSION_INPUT) {
+        ssize_t received = read(session->fd, session->input + session->input_len,
+                                SESSION_INPUT - session->input_len);
+        if (received > 0) {
+            session->input_len += received;
+            continue;
+        }
+        if (received == 0) {
+            session->eof = 1;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        session_close(server, session);
         return;
     }
+    session_dispatch(server, session);
+    session_update(server, session);
+}
 
-    if (pin < 0 || pin > 100000) {
-        printf("Некорректный PIN-код. Допустимый диапазон: от 0 до 100000.\n");
-        pthread_mutex_unlock(&state->mutex);
-        return;
+static void server_accept(Server* server) {
+    while (1) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOMEM || errno == ENOBUFS) {
+                server->accept_paused = 1;
+                server_watch(server, server->listen_fd, &server->listen_fd, 0, EPOLL_CTL_MOD);
+            }
+            return;
+        }
+
+        Server_session* session = calloc(1, sizeof(Server_session));
+        if (session == NULL) {
+            close(fd);
+            continue;
+        }
+        session->ticket.complete = server_complete;
+        session->session.out = &session->reply;
+        session->session.ticket = &session->ticket;
+        session->server = server;
+        session->fd = fd;
+        session->events = EPOLLIN;
+        session->next = server->sessions;
+        if (server->sessions != NULL) {
+            server->sessions->prev = session;
+        }
+        server->sessions = session;
+        server->session_count++;
+        server_watch(server, fd, session, EPOLLIN, EPOLL_CTL_ADD);
     }
+}
 
-    strcpy(state->users[state->user_count].login, login);
-    state->users[state->user_count].pin = pin;
-    state->users[state->user_count].request_limit = -1;
-    state->users[state->user_count].request_count = 0;
-    state->user_count++;
+static void server_completed(Server* server) {
+    uint64_t count;
+    while (read(server->event_fd, &count, sizeof(count)) < 0 && errno == EINTR);
 
-    printf("Пользователь успешно зарегистрирован.\n");
-    pthread_mutex_unlock(&state->mutex);
-}
+    pthread_mutex_lock(&server->mutex);
+    Server_session* session = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->mutex);
 
-void authorization(Current* state) {
-    pthread_mutex_lock(&state->mutex);
-    char login[MAX_LOGIN + 1];
-    int pin;
+    while (session != NULL) {
+        Server_session* next = session->next_done;
+        session->busy = 0;
+        if (session->closing) {
+            session_free(server, session);
+        } else {
+            output_append(&session->send, session->reply.data, session->reply.len);
+            session->reply.len = 0;
+            session_dispatch(server, session);
+            session_update(server, session);
+        }
+        session = next;
+    }
+    server_dispatch_ready(server);
+}
 
-    printf("Авторизация\n");
-    printf("Введите логин: ");
-    if (scanf("%6s", login) != 1) {
-        printf("Ошибка ввода логина.\n");
-        while (getchar() != '\n'); 
-        pthread_mutex_unlock(&state->mutex);
-        return;
+static void unlink_socket(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
     }
+}
 
-    for (int i = 0; i < state->user_count; i++) {
-        if (strcmp(state->users[i].login, login) == 0) {
-            printf("Введите PIN-код: ");
-            if (scanf("%d", &pin) != 1) {
-                printf("Ошибка ввода PIN-кода.\n");
-                while (getchar() != '\n'); 
-                pthread_mutex_unlock(&state->mutex);
-                return;
+static int server_listen(const char* address) {
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        strcpy(addr.sun_path, address + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink_socket(addr.sun_path);
+        if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd != -1) {
+                close(fd);
             }
-
-            while (getchar() != '\n');
-
-            if (state->users[i].pin == pin) {
-                state->current_user = &state->users[i];
-                printf("Добро пожаловать, %s!\n", state->current_user->login);
-                pthread_mutex_unlock(&state->mutex);
-                return;
-            } else {
-                printf("Неверный PIN-код.\n");
-                pthread_mutex_unlock(&state->mutex);
-                return;
+            return -1;
+        }
+    } else if (strncmp(address, "tcp:", 4) == 0) {
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        char host[64] = "127.0.0.1";
+        const char* port = address + 4;
+        const char* colon = strrchr(port, ':');
+        if (colon != NULL) {
+            if ((size_t)(colon - port) >= sizeof(host)) {
+                return -1;
             }
+            memcpy(host, port, colon - port);
+            host[colon - port] = '\0';
+            port = colon + 1;
         }
+        char* end;
+        long port_number = strtol(port, &end, 10);
+        if (*port == '\0' || *end != '\0' || port_number < 0 || port_number > 65535 ||
+            inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            return -1;
+        }
+        addr.sin_port = htons(port_number);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+    } else {
+        return -1;
     }
 
-    printf("Пользователь с таким логином не найден.\n");
-    pthread_mutex_unlock(&state->mutex);
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-void logout(Current* state) {
-    state->current_user = NULL;
-    printf("Вы вышли из системы.\n");
+static void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
 }
 
-void get_time() {
-    time_t now = time(NULL);
-    if (now == -1) {
-        printf("Ошибка при получении времени.\n");
-        return;
-    }
+int run_server(Current* state, Worker_pool* pool, const char* address, const sigset_t* signals) {
+    Server server = {0};
+    server.state = state;
+    server.pool = pool;
+    pthread_mutex_init(&server.mutex, NULL);
+    raise_fd_limit();
 
-    struct tm *tm = localtime(&now);
-    if (tm == NULL) {
-        printf("Ошибка при преобразовании времени.\n");
-        return;
+    server.listen_fd = server_listen(address);
+    if (server.listen_fd == -1) {
+        printf("Ошибка открытия адреса '%s'. Используйте tcp:[адрес:]порт или unix:путь.\n", address);
+        pool_destroy(pool);
+        return 1;
+    }
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (server.epoll_fd == -1 || server.event_fd == -1 || server.signal_fd == -1) {
+        printf("Ошибка инициализации сервера.\n");
+        pool_destroy(pool);
+        return 1;
+    }
+    server_watch(&server, server.listen_fd, &server.listen_fd, EPOLLIN, EPOLL_CTL_ADD);
+    server_watch(&server, server.event_fd, &server.event_fd, EPOLLIN, EPOLL_CTL_ADD);
+    server_watch(&server, server.signal_fd, &server.signal_fd, EPOLLIN, EPOLL_CTL_ADD);
+    if (commit_flusher_start(state) != 0) {
+        printf("Ошибка инициализации сервера.\n");
+        pool_destroy(pool);
+        return 1;
     }
 
-    printf("Текущее время: %02d:%02d:%02d\n", tm->tm_hour, tm->tm_min, tm->tm_sec);
-}
+    printf("Сервер запущен: %s\n", address);
+    fflush(stdout);
 
-void get_date() {
-    time_t now = time(NULL);
-    if (now == -1) {
-        printf("Ошибка при получении времени.\n");
-        return;
-    }
+    struct epoll_event events[SERVER_EVENTS];
+    int running = 1;
+    while (running) {
+        int count = epoll_wait(server.epoll_fd, events, SERVER_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Ошибка ожидания событий.\n");
+            break;
+        }
 
-    struct tm *tm = localtime(&now);
-    if (tm == NULL) {
-        printf("Ошибка при преобразовании времени.\n");
-        return;
+        for (int i = 0; i < count; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &server.listen_fd) {
+                server_accept(&server);
+            } else if (ptr == &server.event_fd) {
+                server_completed(&server);
+            } else if (ptr == &server.signal_fd) {
+                running = 0;
+            } else {
+                Server_session* session = (Server_session*)ptr;
+                if (session->fd == -1) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    session_close(&server, session);
+                } else if (events[i].events & EPOLLIN) {
+                    session_read(&server, session);
+                } else if (events[i].events & EPOLLOUT) {
+                    session_dispatch(&server, session);
+                    session_update(&server, session);
+                }
+            }
+        }
+        server_free_closed(&server);
     }
 
-    printf("Текущая дата: %02d:%02d:%04d\n", tm->tm_mday, tm->tm_mon + 1, tm->tm_year + 1900);
+    pool_destroy(pool);
+    commit_flusher_stop(state);
+    while (server.sessions != NULL) {
+        Server_session* session = server.sessions;
+        if (session->fd != -1) {
+            close(session->fd);
+        }
+        session->busy = 0;
+        session_free(&server, session);
+    }
+    server_free_closed(&server);
+    close(server.listen_fd);
+    if (strncmp(address, "unix:", 5) == 0) {
+        unlink_socket(address + 5);
+    }
+    close(server.event_fd);
+    close(server.signal_fd);
+    close(server.epoll_fd);
+    pthread_mutex_destroy(&server.mutex);
+    printf("Сервер остановлен.\n");
+    return 0;
 }
 
-void howmuch(const char *time_str, const char *flag) {
-    struct tm time_in = {0}; 
-    int day, month, year;
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    if (sscanf(time_str, "%d:%d:%d", &day, &month, &year) != 3) {
-        printf("Некорректный формат даты. Используйте формат дд:мм:гггг.\n");
-        return;
+static void bench_login(uint64_t n, char first, char* login) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    login[0] = first;
+    for (int i = MAX_LOGIN - 1; i >= 1; i--) {
+        login[i] = digits[n % 36];
+        n /= 36;
     }
+    login[MAX_LOGIN] = '\0';
+}
 
-    if (day < 1 || day > 31 || month < 1 || month > 12 || year < 1900) {
-        printf("Некорректная дата. Проверьте введённые значения.\n");
-        return;
-    }
+int bench_user_store(size_t max_users) {
+    printf("%12s %16s %16s %16s\n", "пользователей", "регистраций/с", "поисков/с", "промахов/с");
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (size_t users = 1000; users <= max_users; users *= 10) {
+        User_store store;
+        user_store_init(&store);
+        char login[MAX_LOGIN + 1];
 
-    time_in.tm_mday = day;
-    time_in.tm_mon = month - 1;  
-    time_in.tm_year = year - 1900; 
+        double start = now_seconds();
+        for (size_t i = 0; i < users; i++) {
+            bench_login(i, 'a' + i / 60466176 % 26, login);
+            if (user_store_add(&store, login, (int)(i % 100000)) == NULL) {
+                printf("Ошибка выделения памяти.\n");
+                user_store_free(&store);
+                return 1;
+            }
+        }
+        double add_time = now_seconds() - start;
 
-    time_t first = mktime(&time_in);
-    if (first == -1) {
-        printf("Ошибка при разборе даты.\n");
-        return;
-    }
+        size_t found = 0;
+        start = now_seconds();
+        for (size_t i = 0; i < users; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            size_t n = seed % users;
+            bench_login(n, 'a' + n / 60466176 % 26, login);
+            found += user_store_find(&store, login) != NULL;
+        }
+        double find_time = now_seconds() - start;
 
-    time_t now = time(NULL);
-    if (now == -1) {
-        printf("Ошибка при получении текущего времени.\n");
-        return;
+        size_t missed = 0;
+        start = now_seconds();
+        for (size_t i = 0; i < users; i++) {
+            bench_login(i, 'Z', login);
+            missed += user_store_find(&store, login) == NULL;
+        }
+        double miss_time = now_seconds() - start;
+
+        if (found != users || missed != users) {
+            printf("Ошибка проверки: найдено %zu, промахов %zu из %zu\n", found, missed, users);
+            user_store_free(&store);
+            return 1;
+        }
+        printf("%12zu %16.0f %16.0f %16.0f\n", users, users / add_time, users / find_time, users / miss_time);
+        user_store_free(&store);
     }
+    return 0;
+}
 
-    double res = difftime(now, first);
+typedef struct {
+    Current* state;
+    Worker_pool* pool;
+    User* user;
+    size_t count;
+    double* latencies;
+} Bench_client;
 
-    if (strcmp(flag, "-s") == 0) {
-        printf("Прошло секунд: %.0f\n", res); 
-    } else if (strcmp(flag, "-m") == 0) {
-        printf("Прошло минут: %.0f\n", res / 60); 
-    } else if (strcmp(flag, "-h") == 0) {
-        printf("Прошло часов: %.0f\n", res / 3600); 
-    } else if (strcmp(flag, "-y") == 0) {
-        printf("Прошло лет: %.0f\n", res / (3600 * 24 * 365)); 
-    } else {
-        printf("Некорректный флаг. Допустимые флаги: -s, -m, -h, -y.\n");
+static void* bench_client(void* arg) {
+    Bench_client* client = (Bench_client*)arg;
+    Session session = { .user = client->user };
+    Command_ticket ticket = { .complete = NULL };
+    sem_init(&ticket.done, 0, 0);
+    for (size_t i = 0; i < client->count; i++) {
+        double start = now_seconds();
+        if (client->pool != NULL) {
+            pool_run(client->pool, &session, "Date", &ticket);
+        } else {
+            pthread_t thread;
+            Thread_args* args = malloc(sizeof(Thread_args));
+            args->state = client->state;
+            args->session = &session;
+            args->command = strdup("Date");
+            if (pthread_create(&thread, NULL, process_command_thread, args) == 0) {
+                pthread_join(thread, NULL);
+            }
+        }
+        client->latencies[i] = now_seconds() - start;
     }
+    sem_destroy(&ticket.done);
+    return NULL;
 }
 
-void set_sanctions(Current* state, const char *username, int number) {
-    pthread_mutex_lock(&state->mutex);
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-    if (number < 0) {
-        printf("Число должно быть неотрицательным.\n");
-        pthread_mutex_unlock(&state->mutex);
-        return;
+int bench_commands(size_t count, int clients) {
+    Current state = {0};
+    user_store_init(&state.users);
+    User* user = user_store_add(&state.users, "bench", 0);
+    double* latencies = malloc(count * clients * sizeof(double));
+    Bench_client* client_args = malloc(clients * sizeof(Bench_client));
+    pthread_t* threads = malloc(clients * sizeof(pthread_t));
+    if (user == NULL || latencies == NULL || client_args == NULL || threads == NULL) {
+        printf("Ошибка выделения памяти.\n");
+        return 1;
     }
 
-    char confirmation[6];
-    printf("Введите 12345 для подтверждения: ");
-    if (scanf("%5s", confirmation) != 1) {
-        printf("Ошибка ввода подтверждения.\n");
-        while (getchar() != '\n'); 
-        pthread_mutex_unlock(&state->mutex);
-        return;
+    Worker_pool pool;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool_init(&pool, &state, thread_count > 0 ? thread_count : 1) != 0) {
+        printf("Ошибка создания потока.\n");
+        return 1;
     }
 
-    while (getchar() != '\n');
+    printf("модель           клиентов       команд/с     p50, мкс     p99, мкс\n");
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
 
-    if (strcmp(confirmation, "12345") != 0) {
-        printf("Подтверждение не удалось.\n");
-        pthread_mutex_unlock(&state->mutex);
-        return;
-    }
+    for (int model = 0; model < 2; model++) {
+        for (int active = 1; ; active = active * 2 < clients ? active * 2 : clients) {
+            dup2(null_fd, STDOUT_FILENO);
+            double start = now_seconds();
+            for (int i = 0; i < active; i++) {
+                client_args[i].state = &state;
+                client_args[i].pool = model == 1 ? &pool : NULL;
+                client_args[i].user = user;
+                client_args[i].count = count;
+                client_args[i].latencies = latencies + i * count;
+                pthread_create(&threads[i], NULL, bench_client, &client_args[i]);
+            }
+            for (int i = 0; i < active; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            double elapsed = now_seconds() - start;
+            fflush(stdout);
+            dup2(saved_stdout, STDOUT_FILENO);
 
-    for (int i = 0; i < state->user_count; i++) {
-        if (strcmp(state->users[i].login, username) == 0) {
-            state->users[i].request_limit = number;
-            printf("Для пользователя %s установлено ограничение в %d запросов.\n", username, number);
-            pthread_mutex_unlock(&state->mutex);
-            return;
+            size_t total = count * active;
+            qsort(latencies, total, sizeof(double), compare_double);
+            printf("%-16s %8d %14.0f %12.1f %12.1f\n", model == 1 ? "pool" : "pthread_create",
+                   active, total / elapsed, latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6);
+            fflush(stdout);
+            if (active == clients) {
+                break;
+            }
         }
     }
 
-    printf("Пользователь с логином %s не найден.\n", username);
-    pthread_mutex_unlock(&state->mutex);
+    close(null_fd);
+    close(saved_stdout);
+    pool_destroy(&pool);
+    user_store_free(&state.users);
+    free(latencies);
+    free(client_args);
+    free(threads);
+    return 0;
 }
 
 typedef struct {
-    Current* state;
-    char* command;
-} Thread_args;
+    User_store records;
+    User_shard table;
+    pthread_mutex_t mutex;
+} Legacy_store;
 
-void* process_command_thread(void* arg) {
-    Thread_args* args = (Thread_args*)arg;
-    Current* state = args->state;
-    char* command = args->command;
+static User* legacy_find(Legacy_store* legacy, const char* login) {
+    return user_shard_find(&legacy->records, &legacy->table, login_key(login));
+}
 
-    pthread_mutex_lock(&state->mutex);
-    if (state->current_user == NULL) {
-        printf("Пользователь не авторизован.\n");
-        pthread_mutex_unlock(&state->mutex);
-        free(command);
-        free(args);
-        pthread_exit(NULL);
+static User* legacy_add(Legacy_store* legacy, const char* login) {
+    if (legacy_find(legacy, login) != NULL || user_store_reserve(&legacy->records, legacy->records.count + 1) != 0) {
+        return NULL;
     }
-
-    if (state->current_user->request_limit != -1 && 
-        state->current_user->request_count >= state->current_user->request_limit) {
-        printf("Превышено количество запросов.\n");
-        logout(state);
-        pthread_mutex_unlock(&state->mutex);
-        free(command);
-        free(args);
-        pthread_exit(NULL);
+    size_t index = legacy->records.count;
+    User* user = user_at(&legacy->records, index);
+    memset(user, 0, sizeof(User));
+    memcpy(user->login, login, strnlen(login, MAX_LOGIN));
+    user->request_limit = -1;
+    if (user_shard_insert(&legacy->table, login_key(login), index) != 0) {
+        return NULL;
     }
+    legacy->records.count++;
+    return user;
+}
 
-    state->current_user->request_count++;
-    pthread_mutex_unlock(&state->mutex);
+typedef struct {
+    User_store* store;
+    Legacy_store* legacy;
+    size_t users;
+    size_t ops;
+    int id;
+    size_t failures;
+} Stress_worker;
 
-    if (strcmp(command, "Time") == 0) {
-        get_time();
-    } else if (strcmp(command, "Date") == 0) {
-        get_date();
-    } else if (strncmp(command, "Howmuch", 7) == 0) {
-        char time_str[11];
-        char flag[3];
-        if (sscanf(command, "Howmuch %10s %2s", time_str, flag) == 2) {
-            howmuch(time_str, flag);
-        } else {
-            printf("Некорректный формат команды. Используйте: <Howmuch> <дд:мм:гггг> <-флаг>.\n");
+static void* stress_worker(void* arg) {
+    Stress_worker* worker = (Stress_worker*)arg;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL * (worker->id + 1);
+    uint64_t registered = 0;
+    char login[MAX_LOGIN + 1];
+
+    for (size_t i = 0; i < worker->ops; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        size_t n = seed % worker->users;
+        int op = (seed >> 32) % 100;
+
+        if (worker->legacy != NULL) {
+            Legacy_store* legacy = worker->legacy;
+            pthread_mutex_lock(&legacy->mutex);
+            if (op < 90) {
+                User* user = user_at(&legacy->records, n);
+                if (user->request_limit != -1 && user->request_count >= user->request_limit) {
+                    worker->failures++;
+                } else {
+                    user->request_count++;
+                }
+            } else if (op < 99) {
+                bench_login(n, 'a' + n / 60466176 % 26, login);
+                if (legacy_find(legacy, login) == NULL) {
+                    worker->failures++;
+                }
+            } else {
+                bench_login(registered++, 'A' + worker->id % 26, login);
+                legacy_add(legacy, login);
+            }
+            pthread_mutex_unlock(&legacy->mutex);
+            continue;
         }
-    } else if (strcmp(command, "Logout") == 0) {
-        logout(state);
-    } else if (strncmp(command, "Sanctions", 9) == 0) {
-        char username[MAX_LOGIN + 1];
-        int number;
 
-        if (sscanf(command, "Sanctions %6s %d", username, &number) == 2) {
-            set_sanctions(state, username, number);
+        if (op < 90) {
+            if (!user_try_request(user_at(worker->store, n))) {
+                worker->failures++;
+            }
+        } else if (op < 99) {
+            bench_login(n, 'a' + n / 60466176 % 26, login);
+            if (user_store_find(worker->store, login) == NULL) {
+                worker->failures++;
+            }
         } else {
-            printf("Некорректный формат команды. Используйте: <Sanctions> <логин> <число>.\n");
+            bench_login(registered++, 'A' + worker->id % 26, login);
+            user_store_add(worker->store, login, 0);
         }
-    } else {
-        printf("Некорректная команда.\n");
     }
+    return NULL;
+}
 
-    free(command);
-    free(args);
-    pthread_exit(NULL);
+int bench_stress(size_t ops, int max_threads) {
+    const size_t users = 100000;
+    Stress_worker* workers = malloc(max_threads * sizeof(Stress_worker));
+    pthread_t* threads = malloc(max_threads * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        printf("Ошибка выделения памяти.\n");
+        return 1;
+    }
+    printf("Процессоров: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("потоков    общий мьютекс, оп/с    шарды и CAS, оп/с    ускорение\n");
+    for (int count = 1; ; count = count * 2 < max_threads ? count * 2 : max_threads) {
+        double rates[2];
+        for (int mode = 0; mode < 2; mode++) {
+            User_store store;
+            Legacy_store legacy = {0};
+            user_store_init(&store);
+            user_store_init(&legacy.records);
+            pthread_mutex_init(&legacy.mutex, NULL);
+            User_store* records = mode == 0 ? &legacy.records : &store;
+            char login[MAX_LOGIN + 1];
+            for (size_t i = 0; i < users; i++) {
+                bench_login(i, 'a' + i / 60466176 % 26, login);
+                if ((mode == 0 ? legacy_add(&legacy, login) : user_store_add(&store, login, 0)) == NULL) {
+                    printf("Ошибка выделения памяти.\n");
+                    return 1;
+                }
+            }
+
+            double start = now_seconds();
+            for (int i = 0; i < count; i++) {
+                workers[i] = (Stress_worker){ &store, mode == 0 ? &legacy : NULL, users, ops, i, 0 };
+                pthread_create(&threads[i], NULL, stress_worker, &workers[i]);
+            }
+            size_t failures = 0;
+            for (int i = 0; i < count; i++) {
+                pthread_join(threads[i], NULL);
+                failures += workers[i].failures;
+            }
+            rates[mode] = ops * count / (now_seconds() - start);
+
+            size_t requests = 0;
+            for (size_t i = 0; i < users; i++) {
+                requests += user_at(records, i)->request_count;
+            }
+            size_t expected = 0;
+            for (int i = 0; i < count; i++) {
+                expected += workers[i].ops;
+            }
+            user_store_free(&store);
+            user_store_free(&legacy.records);
+            free(legacy.table.slots);
+            pthread_mutex_destroy(&legacy.mutex);
+            if (failures != 0 || requests == 0 || requests > expected) {
+                printf("Ошибка проверки: %zu ошибок, %zu запросов\n", failures, requests);
+                return 1;
+            }
+        }
+        printf("%7d %22.0f %20.0f %12.2f\n", count, rates[0], rates[1], rates[1] / rates[0]);
+        fflush(stdout);
+        if (count == max_threads) {
+            break;
+        }
+    }
+
+    free(workers);
+    free(threads);
+    return 0;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench-stress") == 0) {
+        size_t ops = argc > 2 ? strtoull(argv[2], NULL, 10) : 2000000;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int max_threads = argc > 3 ? atoi(argv[3]) : (cpus > 0 ? cpus : 1);
+        if (ops == 0 || max_threads <= 0) {
+            printf("Некорректные параметры теста.\n");
+            return 1;
+        }
+        return bench_stress(ops, max_threads);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-commands") == 0) {
+        size_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000;
+        int clients = argc > 3 ? atoi(argv[3]) : 4;
+        if (count == 0 || clients <= 0) {
+            printf("Некорректные параметры теста.\n");
+            return 1;
+        }
+        return bench_commands(count, clients);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        size_t max_users = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+        return bench_user_store(max_users);
+    }
+
+    const char* db_path = NULL;
+    const char* server_address = NULL;
+    static struct option long_options[] = {
+        { "db", required_argument, NULL, 'd' },
+        { "server", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'd':
+                db_path = optarg;
+                break;
+            case 's':
+                server_address = optarg;
+                break;
+            default:
+                printf("Использование: %s [--db файл] [--server tcp:[адрес:]порт | unix:путь]\n", argv[0]);
+                return 1;
+        }
+    }
+
     Current state = {0};
-    pthread_mutex_init(&state.mutex, NULL);
+    if (db_path != NULL) {
+        char wal_path[4096];
+        snprintf(wal_path, sizeof(wal_path), "%s.wal", db_path);
+        size_t replayed = 0;
+        if (user_store_open(&state.users, db_path) != 0 ||
+            (state.wal = wal_open(wal_path, &state.users, &replayed)) == NULL) {
+            printf("Ошибка открытия базы пользователей '%s'.\n", db_path);
+            return 1;
+        }
+        if (replayed > 0) {
+            printf("Восстановлено записей из журнала: %zu\n", replayed);
+        }
+        if (state.users.reserved < USER_RESERVE) {
+            printf("Адресное пространство ограничено: база вмещает не более %zu пользователей.\n",
+                   user_store_limit(&state.users));
+        }
+    } else {
+        user_store_init(&state.users);
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    if (server_address != NULL) {
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    }
+
+    Worker_pool pool;
+    Command_ticket ticket = { .complete = NULL };
+    Session console = {0};
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool_init(&pool, &state, thread_count > 0 ? thread_count : 1) != 0) {
+        printf("Ошибка создания потока.\n");
+        return 1;
+    }
+
+    if (server_address != NULL) {
+        int status = run_server(&state, &pool, server_address, &signals);
+        if (state.wal != NULL) {
+            wal_close(state.wal);
+        }
+        user_store_free(&state.users);
+        return status;
+    }
+    sem_init(&ticket.done, 0, 0);
 
     while (1) {
-        if (state.current_user == NULL) {
+        if (console.user == NULL) {
             printf("\n1. Авторизация\n");
             printf("2. Регистрация\n");
             printf("3. Выход\n");
@@ -352,22 +2221,29 @@ int main() {
     
             switch (choice) {
                 case 1:
-                    authorization(&state);
+                    authorization(&state, &console);
                     break;
                 case 2:
                     registration(&state);
                     break;
                 case 3:
-                    pthread_mutex_destroy(&state.mutex);
+                    pool_destroy(&pool);
+                    sem_destroy(&ticket.done);
+                    if (state.wal != NULL) {
+                        wal_close(state.wal);
+                    }
+                    user_store_free(&state.users);
                     return 0; 
                 default:
                     printf("Некорректное действие. Введите число от 1 до 3.\n");
             }
         } else {
-            while (state.current_user != NULL) {
-                char command[128];
+            while (console.user != NULL) {
+                char command[MAX_COMMAND];
 
-                printf("@%s: ", state.current_user->login);
+                if (!console.confirming) {
+                    printf("@%s: ", console.user->login);
+                }
                 if (fgets(command, sizeof(command), stdin) == NULL) {
                     printf("Ошибка ввода команды.\n");
                     continue;
@@ -379,42 +2255,17 @@ int main() {
                     continue;
                 }
 
-                pthread_mutex_lock(&state.mutex);
-                if (state.current_user->request_limit != -1 && 
-                    state.current_user->request_count >= state.current_user->request_limit) {
-                    printf("Превышено количество запросов.\n");
-                    logout(&state);
-                    pthread_mutex_unlock(&state.mutex);
-                    break;
-                }
-                pthread_mutex_unlock(&state.mutex);
-
-                pthread_t thread;
-                char* command_copy = strdup(command);
-                if (command_copy == NULL) {
-                    printf("Ошибка выделения памяти.\n");
-                    continue;
-                }
-                
-                Thread_args* args = malloc(sizeof(Thread_args));
-                if (args == NULL) {
-                    printf("Ошибка выделения памяти.\n");
-                    free(command_copy);
-                    continue;
-                }
-                args->state = &state;
-                args->command = command_copy;
-
-                if (pthread_create(&thread, NULL, process_command_thread, args) != 0) {
-                    printf("Ошибка создания потока.\n");
-                    free(command_copy);
-                    free(args);
-                    continue;
+                if (!console.confirming) {
+                    if (user_limit_reached(console.user)) {
+                        printf("Превышено количество запросов.\n");
+                        logout(&console);
+                        break;
+                    }
                 }
 
-                pthread_join(thread, NULL);
+                pool_run(&pool, &console, command, &ticket);
 
-                if (state.current_user == NULL) {
+                if (console.user == NULL) {
                     break;
                 }
             }
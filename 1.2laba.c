@@ -1,16 +1,48 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <stdarg.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define PATH_MAX 4096
-#define MAX_PROCESSES 10
+#define XOR_LANES 32
+#define STREAM_CHUNK (1 << 20)
+#define XOR_RANGE_MIN (4 << 20)
+#define XOR_RANGES_PER_THREAD 4
+#define XOR_MAX_N 20
+#define SEARCH_SHORT_MAX 32
+#define AC_DENSE_MAX (64 << 20)
+#define OUT_BUFFER_SIZE (64 << 10)
+#define IO_HEADROOM (64 << 10)
+#define MASK_GROUP 64
+#define IO_DEFAULT_QUEUE_DEPTH 8
+#define CACHE_MAGIC 0x314C5241424C3231ULL
+#define CACHE_VERSION 2
+#define CACHE_HEADER_SIZE 4096
+#define CACHE_LOG_PER_SLOT 512
+#define CACHE_PROBE 8
+#define CACHE_DEFAULT_SLOTS 65536
+#define XOR_CHECKPOINT_TAIL 16
+#define XOR_CHECKPOINT_SALT 0x5851524348454B50ULL
 
 int file_exists(const char *filename) {
     struct stat st;
@@ -27,232 +59,3328 @@ int is_hex(const char *s) {
     return 1;
 }
 
-void xor_operation(const char* filename, int N) {
-    FILE *file = fopen(filename, "rb");
+typedef struct {
+    void (*run)(void *arg);
+    void *arg;
+} Task;
+
+typedef struct {
+    Task *tasks;
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t mutex;
+} Task_deque;
+
+typedef struct Thread_pool Thread_pool;
+
+typedef struct {
+    Thread_pool *pool;
+    int index;
+} Worker;
+
+struct Thread_pool {
+    pthread_t *threads;
+    Worker *workers;
+    int thread_count;
+    Task_deque *deques;
+    int deque_count;
+    int stop;
+    int queued;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef struct {
+    int pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} Wait_group;
+
+static __thread Thread_pool *current_pool = NULL;
+static __thread int current_worker = -1;
+
+int task_deque_init(Task_deque *deque) {
+    deque->capacity = 64;
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->tasks = malloc(deque->capacity * sizeof(Task));
+    pthread_mutex_init(&deque->mutex, NULL);
+    return deque->tasks ? 0 : -1;
+}
+
+int task_deque_push(Task_deque *deque, Task task) {
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom - deque->top == deque->capacity) {
+        Task *tasks = malloc(deque->capacity * 2 * sizeof(Task));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->mutex);
+            return -1;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++) {
+            tasks[i % (deque->capacity * 2)] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity *= 2;
+    }
+    deque->tasks[deque->bottom % deque->capacity] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->mutex);
+    return 0;
+}
+
+int task_deque_pop(Task_deque *deque, Task *task) {
+    pthread_mutex_lock(&deque->mutex);
+    int found = deque->bottom != deque->top;
+    if (found) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+int task_deque_steal(Task_deque *deque, Task *task) {
+    pthread_mutex_lock(&deque->mutex);
+    int found = deque->bottom != deque->top;
+    if (found) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+void task_deque_destroy(Task_deque *deque) {
+    free(deque->tasks);
+    pthread_mutex_destroy(&deque->mutex);
+}
+
+int thread_pool_take(Thread_pool *pool, int self, Task *task) {
+    if (self >= 0 && task_deque_pop(&pool->deques[self], task)) {
+        return 1;
+    }
+    if (task_deque_steal(&pool->deques[pool->thread_count], task)) {
+        return 1;
+    }
+    int start = self >= 0 ? self + 1 : 0;
+    for (int i = 0; i < pool->thread_count; i++) {
+        int victim = (start + i) % pool->thread_count;
+        if (victim != self && task_deque_steal(&pool->deques[victim], task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void thread_pool_run(Thread_pool *pool, Task task) {
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    task.run(task.arg);
+}
+
+static void *thread_pool_worker(void *arg) {
+    Worker *worker = (Worker *)arg;
+    Thread_pool *pool = worker->pool;
+    current_pool = pool;
+    current_worker = worker->index;
+
+    while (1) {
+        Task task;
+        if (thread_pool_take(pool, worker->index, &task)) {
+            thread_pool_run(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        int stop = pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&pool->mutex);
+        if (stop) break;
+    }
+    return NULL;
+}
+
+int thread_pool_init(Thread_pool *pool, int thread_count) {
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->threads = malloc(sizeof(pthread_t) * thread_count);
+    pool->workers = malloc(sizeof(Worker) * thread_count);
+    pool->deques = malloc(sizeof(Task_deque) * (thread_count + 1));
+    int ready = pool->threads && pool->workers && pool->deques;
+    while (ready && pool->deque_count <= thread_count) {
+        ready = task_deque_init(&pool->deques[pool->deque_count++]) == 0;
+    }
+
+    if (ready) {
+        pool->thread_count = thread_count;
+        for (int i = 0; i < thread_count; i++) {
+            pool->workers[i].pool = pool;
+            pool->workers[i].index = i;
+            if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, &pool->workers[i]) != 0) {
+                pool->thread_count = i;
+                break;
+            }
+        }
+        if (pool->thread_count > 0) return 0;
+    }
+
+    for (int i = 0; i < pool->deque_count; i++) {
+        task_deque_destroy(&pool->deques[i]);
+    }
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->deques);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+    return -1;
+}
+
+int thread_pool_submit(Thread_pool *pool, void (*run)(void *), void *arg) {
+    Task task = { run, arg };
+    int deque = current_pool == pool ? current_worker : pool->thread_count;
+
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    if (task_deque_push(&pool->deques[deque], task) != 0) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+void thread_pool_destroy(Thread_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->deque_count; i++) {
+        task_deque_destroy(&pool->deques[i]);
+    }
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->deques);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+}
+
+void wait_group_init(Wait_group *wg, int pending) {
+    wg->pending = pending;
+    pthread_mutex_init(&wg->mutex, NULL);
+    pthread_cond_init(&wg->cond, NULL);
+}
+
+void wait_group_done(Wait_group *wg) {
+    pthread_mutex_lock(&wg->mutex);
+    if (--wg->pending == 0) {
+        pthread_cond_broadcast(&wg->cond);
+    }
+    pthread_mutex_unlock(&wg->mutex);
+}
+
+void wait_group_wait(Wait_group *wg) {
+    Thread_pool *pool = current_pool;
+    while (pool) {
+        pthread_mutex_lock(&wg->mutex);
+        int pending = wg->pending;
+        pthread_mutex_unlock(&wg->mutex);
+        if (pending == 0) break;
+
+        Task task;
+        if (!thread_pool_take(pool, current_worker, &task)) break;
+        thread_pool_run(pool, task);
+    }
+
+    pthread_mutex_lock(&wg->mutex);
+    while (wg->pending > 0) {
+        pthread_cond_wait(&wg->cond, &wg->mutex);
+    }
+    pthread_mutex_unlock(&wg->mutex);
+    pthread_mutex_destroy(&wg->mutex);
+    pthread_cond_destroy(&wg->cond);
+}
+
+typedef struct Output_order Output_order;
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t len;
+    size_t capacity;
+    size_t written;
+    int spill_fd;
+    off_t spilled;
+    Output_order *order;
+    size_t seq;
+    int done;
+} Out_buffer;
+
+struct Output_order {
+    Out_buffer **buffers;
+    size_t count;
+    size_t next;
+    pthread_mutex_t mutex;
+};
+
+void out_init(Out_buffer *out, int fd, Output_order *order, size_t seq) {
+    memset(out, 0, sizeof(*out));
+    out->fd = fd;
+    out->spill_fd = -1;
+    out->order = order;
+    out->seq = seq;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int out_spill_open(void) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_EXCL, 0600);
+    if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR && errno != ENOENT)) return fd;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/1.2laba.XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd != -1) unlink(path);
+    return fd;
+}
+
+static int out_spill_drain(Out_buffer *out) {
+    if (out->spill_fd == -1) return 0;
+
+    int status = -1;
+    char *chunk = malloc(OUT_BUFFER_SIZE);
+    off_t offset = 0;
+    while (chunk) {
+        ssize_t n = pread(out->spill_fd, chunk, OUT_BUFFER_SIZE, offset);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) status = 0;
+            break;
+        }
+        if (write_all(out->fd, chunk, n) != 0) break;
+        offset += n;
+    }
+    free(chunk);
+    close(out->spill_fd);
+    out->spill_fd = -1;
+    return status;
+}
+
+int out_flush(Out_buffer *out) {
+    if (out->order && __atomic_load_n(&out->order->next, __ATOMIC_ACQUIRE) != out->seq) {
+        if (out->spill_fd == -1) out->spill_fd = out_spill_open();
+        if (out->spill_fd == -1) return -1;
+        if (write_all(out->spill_fd, out->data, out->len) != 0) {
+            if (ftruncate(out->spill_fd, out->spilled) == 0) lseek(out->spill_fd, out->spilled, SEEK_SET);
+            return -1;
+        }
+        out->spilled += out->len;
+    } else if (out_spill_drain(out) != 0 || write_all(out->fd, out->data, out->len) != 0) {
+        out->written += out->len;
+        out->len = 0;
+        return -1;
+    }
+    out->written += out->len;
+    out->len = 0;
+    return 0;
+}
+
+void out_reserve(Out_buffer *out, size_t n) {
+    if (out->len + n > OUT_BUFFER_SIZE) {
+        out_flush(out);
+    }
+    if (out->len + n > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 256;
+        while (capacity < out->len + n) capacity *= 2;
+        char *data = realloc(out->data, capacity);
+        if (!data) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        out->data = data;
+        out->capacity = capacity;
+    }
+}
+
+void out_str(Out_buffer *out, const char *str, size_t len) {
+    out_reserve(out, len);
+    memcpy(out->data + out->len, str, len);
+    out->len += len;
+}
+
+void out_char(Out_buffer *out, char c) {
+    out_reserve(out, 1);
+    out->data[out->len++] = c;
+}
+
+void out_u64(Out_buffer *out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    out_reserve(out, n);
+    while (n > 0) {
+        out->data[out->len++] = digits[--n];
+    }
+}
+
+__attribute__((format(printf, 2, 3)))
+void out_printf(Out_buffer *out, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len <= 0) return;
+
+    out_reserve(out, len + 1);
+    va_start(args, format);
+    vsnprintf(out->data + out->len, len + 1, format, args);
+    va_end(args);
+    out->len += len;
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    size_t limit;
+    int overflow;
+} Result_record;
+
+void record_put(Result_record *record, const void *data, size_t len) {
+    if (!record || record->overflow) return;
+    if (record->len + len > record->limit) {
+        record->overflow = 1;
+        return;
+    }
+    if (record->len + len > record->capacity) {
+        size_t capacity = record->capacity ? record->capacity * 2 : 256;
+        while (capacity < record->len + len) capacity *= 2;
+        uint8_t *grown = realloc(record->data, capacity);
+        if (!grown) {
+            record->overflow = 1;
+            return;
+        }
+        record->data = grown;
+        record->capacity = capacity;
+    }
+    memcpy(record->data + record->len, data, len);
+    record->len += len;
+}
+
+void record_u64(Result_record *record, uint64_t value) {
+    record_put(record, &value, sizeof(value));
+}
+
+int output_order_init(Output_order *order, Out_buffer **buffers, size_t count) {
+    order->buffers = buffers;
+    order->count = count;
+    order->next = 0;
+    return pthread_mutex_init(&order->mutex, NULL);
+}
+
+void output_order_finish(Output_order *order, Out_buffer *out) {
+    pthread_mutex_lock(&order->mutex);
+    out->done = 1;
+    while (order->next < order->count && order->buffers[order->next]->done) {
+        Out_buffer *head = order->buffers[order->next];
+        out_spill_drain(head);
+        write_all(head->fd, head->data, head->len);
+        free(head->data);
+        head->data = NULL;
+        head->len = head->capacity = 0;
+        __atomic_store_n(&order->next, order->next + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&order->mutex);
+}
+
+void output_order_destroy(Output_order *order) {
+    pthread_mutex_destroy(&order->mutex);
+}
+
+enum { IO_MMAP, IO_SYNC, IO_URING };
+
+typedef struct {
+    int kind;
+    int queue_depth;
+} Io_config;
+
+static Io_config io_config = { IO_MMAP, IO_DEFAULT_QUEUE_DEPTH };
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned pending;
+} Uring;
+
+typedef struct {
+    uint64_t offset;
+    size_t len;
+    ssize_t result;
+    int done;
+    struct iovec iov;
+} Io_slot;
+
+typedef struct {
+    int kind;
+    int queue_depth;
+    int registered;
+    int in_flight;
+    uint8_t *buffers;
+    Io_slot *slots;
+    Uring ring;
+} Io_backend;
+
+typedef struct {
+    Io_backend *io;
+    int fd;
+    int uring;
+    uint64_t size;
+    uint64_t submit_offset;
+    uint64_t next_offset;
+    int slot;
+    uint8_t *buffer;
+    size_t headroom;
+    const uint8_t *last_data;
+    size_t last_len;
+} Io_stream;
+
+static int uring_setup(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) return -1;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_ptr;
+    uint8_t *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_destroy(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+static struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return sqe;
+}
+
+static int uring_enter(Uring *ring, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (1) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, min_complete, flags, NULL, 0);
+        if (submitted >= 0) {
+            ring->pending -= submitted;
+            return 0;
+        }
+        if (errno != EINTR) return -1;
+    }
+}
+
+static void io_queue_read(Io_backend *io, int fd, int slot, uint64_t offset, size_t len) {
+    Io_slot *s = &io->slots[slot];
+    uint8_t *target = io->buffers + (size_t)slot * (IO_HEADROOM + STREAM_CHUNK) + IO_HEADROOM;
+    s->offset = offset;
+    s->len = len;
+    s->result = 0;
+    s->done = 0;
+    s->iov.iov_base = target;
+    s->iov.iov_len = len;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&io->ring);
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    if (io->registered) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)target;
+        sqe->len = len;
+        sqe->buf_index = slot;
+    } else {
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&s->iov;
+        sqe->len = 1;
+    }
+    io->in_flight++;
+}
+
+static int io_reap(Io_backend *io, int wait) {
+    if (uring_enter(&io->ring, wait ? 1 : 0) == -1) return -1;
+
+    unsigned head = *io->ring.cq_head;
+    unsigned tail = __atomic_load_n(io->ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &io->ring.cqes[head & *io->ring.cq_mask];
+        Io_slot *s = &io->slots[cqe->user_data];
+        s->result = cqe->res;
+        s->done = 1;
+        io->in_flight--;
+        head++;
+    }
+    __atomic_store_n(io->ring.cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+Io_backend *io_backend_create(const Io_config *config) {
+    Io_backend *io = calloc(1, sizeof(Io_backend));
+    if (!io) return NULL;
+    io->kind = config->kind == IO_URING ? IO_URING : IO_SYNC;
+    io->queue_depth = config->queue_depth;
+    if (io->kind != IO_URING) return io;
+
+    size_t slot_size = IO_HEADROOM + STREAM_CHUNK;
+    io->slots = calloc(io->queue_depth, sizeof(Io_slot));
+    if (!io->slots || posix_memalign((void **)&io->buffers, 4096, slot_size * io->queue_depth) != 0 ||
+        uring_setup(&io->ring, io->queue_depth) == -1) {
+        free(io->slots);
+        io->slots = NULL;
+        io->kind = IO_SYNC;
+        return io;
+    }
+
+    struct iovec *iovs = malloc(io->queue_depth * sizeof(struct iovec));
+    if (iovs) {
+        for (int i = 0; i < io->queue_depth; i++) {
+            iovs[i].iov_base = io->buffers + (size_t)i * slot_size;
+            iovs[i].iov_len = slot_size;
+        }
+        io->registered = syscall(__NR_io_uring_register, io->ring.fd, IORING_REGISTER_BUFFERS,
+                                 iovs, io->queue_depth) == 0;
+        free(iovs);
+    }
+    return io;
+}
+
+void io_backend_destroy(Io_backend *io) {
+    if (io->kind == IO_URING) {
+        uring_destroy(&io->ring);
+        free(io->buffers);
+        free(io->slots);
+    }
+    free(io);
+}
+
+static pthread_key_t io_backend_key;
+static pthread_once_t io_backend_once = PTHREAD_ONCE_INIT;
+
+static void io_backend_key_destroy(void *io) {
+    io_backend_destroy((Io_backend *)io);
+}
+
+static void io_backend_key_init(void) {
+    pthread_key_create(&io_backend_key, io_backend_key_destroy);
+}
+
+Io_backend *io_backend_get(void) {
+    pthread_once(&io_backend_once, io_backend_key_init);
+    Io_backend *io = pthread_getspecific(io_backend_key);
+    if (!io) {
+        io = io_backend_create(&io_config);
+        if (io) pthread_setspecific(io_backend_key, io);
+    }
+    return io;
+}
+
+int io_stream_open_at(Io_stream *stream, Io_backend *io, int fd, size_t overlap, uint64_t start) {
+    memset(stream, 0, sizeof(*stream));
+    stream->io = io;
+    stream->fd = fd;
+    stream->headroom = overlap;
+    stream->submit_offset = start;
+    stream->next_offset = start;
+
+    struct stat st;
+    if (io->kind == IO_URING && overlap <= IO_HEADROOM && io->in_flight == 0 &&
+        fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        stream->uring = 1;
+        stream->size = st.st_size;
+        for (int i = 0; i < io->queue_depth && stream->submit_offset < stream->size; i++) {
+            size_t len = stream->size - stream->submit_offset < STREAM_CHUNK ?
+                         stream->size - stream->submit_offset : STREAM_CHUNK;
+            io_queue_read(io, fd, i, stream->submit_offset, len);
+            stream->submit_offset += len;
+        }
+        return io->in_flight > 0 ? uring_enter(&io->ring, 0) : 0;
+    }
+
+    if (start > 0 && lseek(fd, start, SEEK_SET) == -1) return -1;
+    stream->buffer = malloc(overlap + STREAM_CHUNK);
+    return stream->buffer ? 0 : -1;
+}
+
+int io_stream_open(Io_stream *stream, Io_backend *io, int fd, size_t overlap) {
+    return io_stream_open_at(stream, io, fd, overlap, 0);
+}
+
+static size_t io_stream_carry(Io_stream *stream, uint8_t *dst_end, size_t overlap) {
+    size_t kept = stream->last_len < overlap ? stream->last_len : overlap;
+    memmove(dst_end - kept, stream->last_data + stream->last_len - kept, kept);
+    return kept;
+}
+
+ssize_t io_stream_next(Io_stream *stream, const uint8_t **data, uint64_t *offset) {
+    Io_backend *io = stream->io;
+    size_t overlap = stream->headroom;
+
+    if (!stream->uring) {
+        uint8_t *start = stream->buffer + overlap;
+        size_t kept = stream->last_len > 0 ? io_stream_carry(stream, start, overlap) : 0;
+        ssize_t bytes_read;
+        do {
+            bytes_read = read(stream->fd, start, STREAM_CHUNK);
+        } while (bytes_read == -1 && errno == EINTR);
+        if (bytes_read <= 0) return bytes_read;
+
+        *data = start - kept;
+        *offset = stream->next_offset - kept;
+        stream->next_offset += bytes_read;
+        stream->last_data = *data;
+        stream->last_len = kept + bytes_read;
+        return stream->last_len;
+    }
+
+    if (stream->next_offset >= stream->size) return 0;
+
+    int slot = stream->slot;
+    Io_slot *s = &io->slots[slot];
+    while (!s->done) {
+        if (io_reap(io, 1) == -1) return -1;
+    }
+    if (s->result < 0) {
+        errno = -s->result;
+        return -1;
+    }
+
+    uint8_t *start = (uint8_t *)s->iov.iov_base;
+    size_t got = s->result;
+    while (got < s->len) {
+        ssize_t n = pread(stream->fd, start + got, s->len - got, s->offset + got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (n == 0) {
+            stream->size = s->offset + got;
+            break;
+        }
+        got += n;
+    }
+
+    size_t kept = stream->last_len > 0 ? io_stream_carry(stream, start, overlap) : 0;
+
+    int prev = (slot + io->queue_depth - 1) % io->queue_depth;
+    if (stream->last_len > 0 && stream->submit_offset < stream->size) {
+        size_t len = stream->size - stream->submit_offset < STREAM_CHUNK ?
+                     stream->size - stream->submit_offset : STREAM_CHUNK;
+        io_queue_read(io, stream->fd, prev, stream->submit_offset, len);
+        stream->submit_offset += len;
+        if (uring_enter(&io->ring, 0) == -1) return -1;
+    }
+
+    *data = start - kept;
+    *offset = s->offset - kept;
+    stream->next_offset = s->offset + got;
+    stream->slot = (slot + 1) % io->queue_depth;
+    stream->last_data = *data;
+    stream->last_len = kept + got;
+    return stream->last_len;
+}
+
+void io_stream_close(Io_stream *stream) {
+    Io_backend *io = stream->io;
+    if (stream->uring) {
+        while (io->in_flight > 0) {
+            if (io_reap(io, 1) == -1) break;
+        }
+    }
+    free(stream->buffer);
+}
+
+typedef int (*Chunk_fn)(void *ctx, const uint8_t *data, size_t len, uint64_t offset);
+
+int scan_stream(Io_backend *io, int fd, size_t overlap, Chunk_fn fn, void *ctx) {
+    Io_stream stream;
+    if (!io || io_stream_open(&stream, io, fd, overlap) != 0) {
+        return -1;
+    }
+
+    const uint8_t *data;
+    uint64_t offset;
+    ssize_t len;
+    while ((len = io_stream_next(&stream, &data, &offset)) > 0) {
+        if (fn(ctx, data, len, offset) != 0) break;
+    }
+
+    io_stream_close(&stream);
+    return len >= 0 ? 0 : -1;
+}
+
+int scan_fd(int fd, size_t overlap, Chunk_fn fn, void *ctx) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+
+    if (io_config.kind == IO_MMAP && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            fn(ctx, map, st.st_size, 0);
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+
+    return scan_stream(io_backend_get(), fd, overlap, fn, ctx);
+}
+
+typedef void (*Xor_kernel)(uint8_t *acc, const uint8_t *data, size_t len);
+
+static void xor_kernel_scalar(uint8_t *acc, const uint8_t *data, size_t len) {
+    uint64_t a[XOR_LANES / 8];
+    memcpy(a, acc, XOR_LANES);
+    for (size_t off = 0; off < len; off += XOR_LANES) {
+        uint64_t w[XOR_LANES / 8];
+        memcpy(w, data + off, XOR_LANES);
+        for (int k = 0; k < XOR_LANES / 8; k++) {
+            a[k] ^= w[k];
+        }
+    }
+    memcpy(acc, a, XOR_LANES);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void xor_kernel_sse2(uint8_t *acc, const uint8_t *data, size_t len) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)acc);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(acc + 16));
+    size_t off = 0;
+    for (; off + 4 * XOR_LANES <= len; off += 4 * XOR_LANES) {
+        const __m128i *p = (const __m128i *)(data + off);
+        a0 = _mm_xor_si128(a0, _mm_xor_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 2)));
+        a1 = _mm_xor_si128(a1, _mm_xor_si128(_mm_loadu_si128(p + 1), _mm_loadu_si128(p + 3)));
+        a0 = _mm_xor_si128(a0, _mm_xor_si128(_mm_loadu_si128(p + 4), _mm_loadu_si128(p + 6)));
+        a1 = _mm_xor_si128(a1, _mm_xor_si128(_mm_loadu_si128(p + 5), _mm_loadu_si128(p + 7)));
+    }
+    for (; off < len; off += XOR_LANES) {
+        const __m128i *p = (const __m128i *)(data + off);
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128(p));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128(p + 1));
+    }
+    _mm_storeu_si128((__m128i *)acc, a0);
+    _mm_storeu_si128((__m128i *)(acc + 16), a1);
+}
+
+__attribute__((target("avx2")))
+static void xor_kernel_avx2(uint8_t *acc, const uint8_t *data, size_t len) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+    __m256i a1 = _mm256_setzero_si256();
+    __m256i a2 = _mm256_setzero_si256();
+    __m256i a3 = _mm256_setzero_si256();
+    size_t off = 0;
+    for (; off + 4 * XOR_LANES <= len; off += 4 * XOR_LANES) {
+        const __m256i *p = (const __m256i *)(data + off);
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256(p));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256(p + 1));
+        a2 = _mm256_xor_si256(a2, _mm256_loadu_si256(p + 2));
+        a3 = _mm256_xor_si256(a3, _mm256_loadu_si256(p + 3));
+    }
+    for (; off < len; off += XOR_LANES) {
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i *)(data + off)));
+    }
+    a0 = _mm256_xor_si256(_mm256_xor_si256(a0, a1), _mm256_xor_si256(a2, a3));
+    _mm256_storeu_si256((__m256i *)acc, a0);
+}
+#endif
+
+static void xor_wide_scalar(uint8_t *acc, const uint8_t *data, size_t len, size_t width) {
+    for (size_t off = 0; off < len; off += width) {
+        for (size_t k = 0; k < width; k += 8) {
+            uint64_t a, w;
+            memcpy(&a, acc + k, 8);
+            memcpy(&w, data + off + k, 8);
+            a ^= w;
+            memcpy(acc + k, &a, 8);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void xor_wide_sse2(uint8_t *acc, const uint8_t *data, size_t len, size_t width) {
+    for (size_t off = 0; off < len; off += width) {
+        for (size_t k = 0; k < width; k += 64) {
+            __m128i *a = (__m128i *)(acc + k);
+            const __m128i *p = (const __m128i *)(data + off + k);
+            _mm_store_si128(a, _mm_xor_si128(_mm_load_si128(a), _mm_loadu_si128(p)));
+            _mm_store_si128(a + 1, _mm_xor_si128(_mm_load_si128(a + 1), _mm_loadu_si128(p + 1)));
+            _mm_store_si128(a + 2, _mm_xor_si128(_mm_load_si128(a + 2), _mm_loadu_si128(p + 2)));
+            _mm_store_si128(a + 3, _mm_xor_si128(_mm_load_si128(a + 3), _mm_loadu_si128(p + 3)));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void xor_wide_avx2(uint8_t *acc, const uint8_t *data, size_t len, size_t width) {
+    for (size_t off = 0; off < len; off += width) {
+        for (size_t k = 0; k < width; k += 64) {
+            __m256i *a = (__m256i *)(acc + k);
+            const __m256i *p = (const __m256i *)(data + off + k);
+            _mm256_store_si256(a, _mm256_xor_si256(_mm256_load_si256(a), _mm256_loadu_si256(p)));
+            _mm256_store_si256(a + 1, _mm256_xor_si256(_mm256_load_si256(a + 1), _mm256_loadu_si256(p + 1)));
+        }
+    }
+}
+#endif
+
+typedef void (*Xor_wide_kernel)(uint8_t *acc, const uint8_t *data, size_t len, size_t width);
+
+static Xor_kernel xor_kernel = xor_kernel_scalar;
+static Xor_wide_kernel xor_wide_kernel = xor_wide_scalar;
+
+size_t xor_width(int N) {
+    size_t block = N > 3 ? (size_t)1 << (N - 3) : 1;
+    return block > XOR_LANES ? block : XOR_LANES;
+}
+
+void xor_fold(uint8_t *acc, size_t width, const uint8_t *data, size_t len, uint64_t offset) {
+    while (len > 0 && offset % width != 0) {
+        acc[offset % width] ^= *data++;
+        offset++;
+        len--;
+    }
+
+    size_t bulk = len - len % width;
+    if (bulk > 0) {
+        if (width == XOR_LANES) xor_kernel(acc, data, bulk);
+        else xor_wide_kernel(acc, data, bulk, width);
+    }
+
+    for (size_t i = bulk; i < len; i++) {
+        acc[i - bulk] ^= data[i];
+    }
+}
+
+typedef struct {
+    uint8_t **buffers;
+    size_t *sizes;
+    int count;
+    int depth;
+} Xor_scratch;
+
+static pthread_key_t xor_scratch_key;
+static pthread_once_t xor_scratch_once = PTHREAD_ONCE_INIT;
+
+static void xor_scratch_key_destroy(void *arg) {
+    Xor_scratch *scratch = (Xor_scratch *)arg;
+    for (int i = 0; i < scratch->count; i++) {
+        free(scratch->buffers[i]);
+    }
+    free(scratch->buffers);
+    free(scratch->sizes);
+    free(scratch);
+}
+
+static void xor_scratch_key_init(void) {
+    pthread_key_create(&xor_scratch_key, xor_scratch_key_destroy);
+}
+
+uint8_t *xor_scratch_acquire(size_t width) {
+    pthread_once(&xor_scratch_once, xor_scratch_key_init);
+    Xor_scratch *scratch = pthread_getspecific(xor_scratch_key);
+    if (!scratch) {
+        scratch = calloc(1, sizeof(Xor_scratch));
+        if (!scratch) return NULL;
+        pthread_setspecific(xor_scratch_key, scratch);
+    }
+
+    if (scratch->depth == scratch->count) {
+        uint8_t **buffers = realloc(scratch->buffers, (scratch->count + 1) * sizeof(uint8_t *));
+        if (!buffers) return NULL;
+        scratch->buffers = buffers;
+        size_t *sizes = realloc(scratch->sizes, (scratch->count + 1) * sizeof(size_t));
+        if (!sizes) return NULL;
+        scratch->sizes = sizes;
+        scratch->buffers[scratch->count] = NULL;
+        scratch->sizes[scratch->count] = 0;
+        scratch->count++;
+    }
+
+    int level = scratch->depth;
+    if (scratch->sizes[level] < width) {
+        uint8_t *buffer;
+        if (posix_memalign((void **)&buffer, 64, width) != 0) return NULL;
+        free(scratch->buffers[level]);
+        scratch->buffers[level] = buffer;
+        scratch->sizes[level] = width;
+    }
+
+    scratch->depth++;
+    memset(scratch->buffers[level], 0, width);
+    return scratch->buffers[level];
+}
+
+void xor_scratch_release(void) {
+    Xor_scratch *scratch = pthread_getspecific(xor_scratch_key);
+    scratch->depth--;
+}
+
+int xor_fold_range(int fd, uint8_t *acc, size_t width, uint64_t offset, uint64_t length) {
+    uint64_t skip = offset % sysconf(_SC_PAGESIZE);
+    void *map = mmap(NULL, length + skip, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+    if (map != MAP_FAILED) {
+        madvise(map, length + skip, MADV_SEQUENTIAL);
+        xor_fold(acc, width, (const uint8_t *)map + skip, length, offset);
+        munmap(map, length + skip);
+        return 0;
+    }
+
+    uint8_t *buffer;
+    if (posix_memalign((void **)&buffer, XOR_LANES, STREAM_CHUNK) != 0) {
+        return -1;
+    }
+
+    while (length > 0) {
+        size_t want = length < STREAM_CHUNK ? length : STREAM_CHUNK;
+        ssize_t bytes_read = pread(fd, buffer, want, offset);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        if (bytes_read <= 0) {
+            free(buffer);
+            return bytes_read == 0 ? 0 : -1;
+        }
+        xor_fold(acc, width, buffer, bytes_read, offset);
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+int xor_fold_stream(int fd, uint8_t *acc, size_t width, uint64_t start, uint64_t length) {
+    Io_backend *io = io_backend_get();
+    Io_stream stream;
+    if (!io || io_stream_open_at(&stream, io, fd, 0, start) != 0) {
+        return -1;
+    }
+
+    const uint8_t *data;
+    uint64_t offset;
+    ssize_t len;
+    while (length > 0 && (len = io_stream_next(&stream, &data, &offset)) > 0) {
+        if ((uint64_t)len > length) len = length;
+        xor_fold(acc, width, data, len, offset);
+        length -= len;
+    }
+    if (length == 0) len = 0;
+
+    io_stream_close(&stream);
+    return len == 0 ? 0 : -1;
+}
+
+typedef struct {
+    int fd;
+    uint64_t start;
+    uint64_t size;
+    uint64_t range_size;
+    uint64_t range_count;
+    uint64_t next_range;
+    size_t width;
+    uint8_t *acc;
+    int status;
+    pthread_mutex_t mutex;
+    Wait_group *wg;
+} Xor_parallel;
+
+static void xor_range_task(void *arg) {
+    Xor_parallel *job = (Xor_parallel *)arg;
+    uint8_t *acc = xor_scratch_acquire(job->width);
+    int status = acc ? 0 : -1;
+
+    uint64_t i;
+    while (acc && (i = __atomic_fetch_add(&job->next_range, 1, __ATOMIC_RELAXED)) < job->range_count) {
+        uint64_t offset = i * job->range_size;
+        uint64_t length = job->size - offset < job->range_size ? job->size - offset : job->range_size;
+        if (xor_fold_range(job->fd, acc, job->width, job->start + offset, length) != 0) status = -1;
+    }
+
+    pthread_mutex_lock(&job->mutex);
+    if (acc) {
+        for (size_t k = 0; k < job->width; k++) {
+            job->acc[k] ^= acc[k];
+        }
+    }
+    if (status != 0) job->status = -1;
+    pthread_mutex_unlock(&job->mutex);
+
+    if (acc) xor_scratch_release();
+    wait_group_done(job->wg);
+}
+
+int xor_fold_parallel(int fd, uint8_t *acc, size_t width, uint64_t start, uint64_t size, Thread_pool *pool) {
+    uint64_t range_count = (uint64_t)pool->thread_count * XOR_RANGES_PER_THREAD;
+    uint64_t range_size = (size + range_count - 1) / range_count;
+    if (range_size < XOR_RANGE_MIN) range_size = XOR_RANGE_MIN;
+    range_size = (range_size + STREAM_CHUNK - 1) / STREAM_CHUNK * STREAM_CHUNK;
+    range_count = (size + range_size - 1) / range_size;
+
+    uint64_t task_count = range_count < (uint64_t)pool->thread_count ? range_count : (uint64_t)pool->thread_count;
+
+    Wait_group wg;
+    Xor_parallel job = {0};
+    job.fd = fd;
+    job.start = start;
+    job.size = size;
+    job.range_size = range_size;
+    job.range_count = range_count;
+    job.width = width;
+    job.acc = acc;
+    job.wg = &wg;
+    pthread_mutex_init(&job.mutex, NULL);
+
+    wait_group_init(&wg, task_count);
+    for (uint64_t i = 0; i < task_count; i++) {
+        if (thread_pool_submit(pool, xor_range_task, &job) != 0) {
+            xor_range_task(&job);
+        }
+    }
+    wait_group_wait(&wg);
+
+    pthread_mutex_destroy(&job.mutex);
+    return job.status;
+}
+
+int xor_fold_fd_range(int fd, uint8_t *acc, size_t width, uint64_t offset, uint64_t length,
+                      Thread_pool *pool) {
+    if (io_config.kind != IO_MMAP) {
+        return xor_fold_stream(fd, acc, width, offset, length);
+    }
+    if (pool && pool->thread_count > 1 && length >= 2 * XOR_RANGE_MIN) {
+        return xor_fold_parallel(fd, acc, width, offset, length, pool);
+    }
+    return xor_fold_range(fd, acc, width, offset, length);
+}
+
+int xor_fold_fd(int fd, uint8_t *acc, size_t width, Thread_pool *pool) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        return xor_fold_stream(fd, acc, width, 0, UINT64_MAX);
+    }
+    return xor_fold_fd_range(fd, acc, width, 0, st.st_size, pool);
+}
+
+size_t xor_result_size(int N) {
+    return N == 2 ? 1 : (size_t)1 << (N - 3);
+}
+
+void xor_print(const char *filename, int N, const uint8_t *result, Out_buffer *out) {
+    if (N == 2) {
+        out_printf(out, "Файл %s: XOR2 результат: %02X\n", filename, result[0] & 0x0F);
+        return;
+    }
+
+    size_t block_size_bytes = xor_result_size(N);
+    static const char hex[] = "0123456789ABCDEF";
+    out_printf(out, "Файл %s: XOR%d результат: ", filename, N);
+    out_reserve(out, block_size_bytes * 2 + 1);
+    for (size_t i = 0; i < block_size_bytes; i++) {
+        out->data[out->len++] = hex[result[i] >> 4];
+        out->data[out->len++] = hex[result[i] & 0x0F];
+    }
+    out->data[out->len++] = '\n';
+}
+
+void xor_render(const char *filename, int N, uint8_t *acc, size_t width, Out_buffer *out,
+                Result_record *record) {
+    if (N == 2) {
+        uint8_t folded = 0;
+        for (size_t i = 0; i < width; i++) {
+            folded ^= acc[i];
+        }
+        acc[0] = ((folded >> 4) ^ (folded & 0x0F)) & 0x0F;
+    } else {
+        size_t block_size_bytes = xor_result_size(N);
+        for (size_t i = block_size_bytes; i < width; i++) {
+            acc[i % block_size_bytes] ^= acc[i];
+        }
+    }
+
+    record_put(record, acc, xor_result_size(N));
+    xor_print(filename, N, acc, out);
+}
+
+int xor_operation(const char* filename, int N, Thread_pool *pool, Out_buffer *out, Result_record *record) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
+        return -1;
+    }
+
+    size_t width = xor_width(N);
+    uint8_t *acc = xor_scratch_acquire(width);
+    if (!acc) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        close(fd);
+        return -1;
+    }
+
+    if (xor_fold_fd(fd, acc, width, pool) == -1) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
+        xor_scratch_release();
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    xor_render(filename, N, acc, width, out, record);
+    xor_scratch_release();
+    return 0;
+}
+
+enum { MASK_VERBOSE, MASK_COUNT, MASK_OFFSETS_TEXT, MASK_OFFSETS_BIN };
+enum { MASK_W8, MASK_W16, MASK_W32, MASK_W64, MASK_WIDTHS };
+
+typedef struct {
+    int mode;
+    int width;
+    int swap;
+    uint64_t start;
+    uint64_t stride;
+} Mask_options;
+
+typedef uint64_t (*Mask_kernel)(const uint8_t *data, uint64_t mask, size_t stride);
+
+#define DEFINE_MASK_SCALAR_KERNELS(W) \
+static uint64_t mask_kernel##W##_packed(const uint8_t *data, uint64_t mask, size_t stride) { \
+    const uint##W##_t m = (uint##W##_t)mask; \
+    uint64_t bits = 0; \
+    (void)stride; \
+    for (int i = 0; i < MASK_GROUP; i++) { \
+        uint##W##_t value; \
+        memcpy(&value, data + i * sizeof(value), sizeof(value)); \
+        bits |= (uint64_t)((value & m) == m) << i; \
+    } \
+    return bits; \
+} \
+static uint64_t mask_kernel##W##_strided(const uint8_t *data, uint64_t mask, size_t stride) { \
+    const uint##W##_t m = (uint##W##_t)mask; \
+    uint64_t bits = 0; \
+    for (int i = 0; i < MASK_GROUP; i++) { \
+        uint##W##_t value; \
+        memcpy(&value, data + i * stride, sizeof(value)); \
+        bits |= (uint64_t)((value & m) == m) << i; \
+    } \
+    return bits; \
+}
+
+DEFINE_MASK_SCALAR_KERNELS(8)
+DEFINE_MASK_SCALAR_KERNELS(16)
+DEFINE_MASK_SCALAR_KERNELS(32)
+DEFINE_MASK_SCALAR_KERNELS(64)
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint32_t compress_even_bits(uint32_t x) {
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    x = (x | (x >> 8)) & 0x0000FFFF;
+    return x;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_cmpeq_epi64(__m128i a, __m128i b) {
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+#define DEFINE_MASK_SIMD_KERNEL(NAME, TARGET, VEC, LOADU, AND, SET1, EQ, LANE_BITS, LANES, W) \
+__attribute__((target(TARGET))) \
+static uint64_t NAME(const uint8_t *data, uint64_t mask, size_t stride) { \
+    const VEC m = SET1((uint##W##_t)mask); \
+    uint64_t bits = 0; \
+    (void)stride; \
+    for (int i = 0; i < MASK_GROUP; i += LANES) { \
+        VEC v = LOADU((const VEC *)(data + i * (W / 8))); \
+        VEC eq = EQ(AND(v, m), m); \
+        bits |= (uint64_t)(LANE_BITS) << i; \
+    } \
+    return bits; \
+}
+
+DEFINE_MASK_SIMD_KERNEL(mask_kernel8_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_and_si128,
+                        _mm_set1_epi8, _mm_cmpeq_epi8, (uint32_t)_mm_movemask_epi8(eq), 16, 8)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel16_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_and_si128,
+                        _mm_set1_epi16, _mm_cmpeq_epi16, compress_even_bits(_mm_movemask_epi8(eq)), 8, 16)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel32_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_and_si128,
+                        _mm_set1_epi32, _mm_cmpeq_epi32, _mm_movemask_ps(_mm_castsi128_ps(eq)), 4, 32)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel64_sse2, "sse2", __m128i, _mm_loadu_si128, _mm_and_si128,
+                        _mm_set1_epi64x, sse2_cmpeq_epi64, _mm_movemask_pd(_mm_castsi128_pd(eq)), 2, 64)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel8_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_and_si256,
+                        _mm256_set1_epi8, _mm256_cmpeq_epi8, (uint32_t)_mm256_movemask_epi8(eq), 32, 8)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel16_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_and_si256,
+                        _mm256_set1_epi16, _mm256_cmpeq_epi16, compress_even_bits(_mm256_movemask_epi8(eq)), 16, 16)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel32_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_and_si256,
+                        _mm256_set1_epi32, _mm256_cmpeq_epi32, _mm256_movemask_ps(_mm256_castsi256_ps(eq)), 8, 32)
+DEFINE_MASK_SIMD_KERNEL(mask_kernel64_avx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_and_si256,
+                        _mm256_set1_epi64x, _mm256_cmpeq_epi64, _mm256_movemask_pd(_mm256_castsi256_pd(eq)), 4, 64)
+#endif
+
+static Mask_kernel mask_packed_kernels[MASK_WIDTHS] = {
+    mask_kernel8_packed, mask_kernel16_packed, mask_kernel32_packed, mask_kernel64_packed
+};
+
+static const Mask_kernel mask_strided_kernels[MASK_WIDTHS] = {
+    mask_kernel8_strided, mask_kernel16_strided, mask_kernel32_strided, mask_kernel64_strided
+};
+
+static uint64_t load_word(const uint8_t *p, int bytes) {
+    uint8_t v8;
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+    switch (bytes) {
+        case 1: memcpy(&v8, p, 1); return v8;
+        case 2: memcpy(&v16, p, 2); return v16;
+        case 4: memcpy(&v32, p, 4); return v32;
+        default: memcpy(&v64, p, 8); return v64;
+    }
+}
+
+static uint64_t swap_word(uint64_t value, int bytes) {
+    switch (bytes) {
+        case 1: return value;
+        case 2: return __builtin_bswap16(value);
+        case 4: return __builtin_bswap32(value);
+        default: return __builtin_bswap64(value);
+    }
+}
+
+typedef struct {
+    const Mask_options *options;
+    uint64_t mask;
+    uint64_t native_mask;
+    int bytes;
+    Mask_kernel kernel;
+    uint64_t next_record;
+    uint64_t matches;
+    uint64_t total;
+    Out_buffer *out;
+    Result_record *record;
+} Mask_ctx;
+
+static void out_hex(Out_buffer *out, uint64_t value, int digits) {
+    static const char hex[] = "0123456789abcdef";
+    out_reserve(out, digits);
+    for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        out->data[out->len++] = hex[(value >> shift) & 0x0F];
+    }
+}
+
+static void mask_print_item(Out_buffer *out, int mode, int bytes, uint64_t item) {
+    if (mode == MASK_VERBOSE) {
+        out_str(out, "Совпадение: 0x", strlen("Совпадение: 0x"));
+        out_hex(out, item, bytes * 2);
+        out_char(out, '\n');
+    } else if (mode == MASK_OFFSETS_TEXT) {
+        out_u64(out, item);
+        out_char(out, '\n');
+    } else {
+        out_str(out, (const char *)&item, sizeof(item));
+    }
+}
+
+static void mask_report(Mask_ctx *ctx, uint64_t offset, const uint8_t *p) {
+    uint64_t item = offset;
+    if (ctx->options->mode == MASK_VERBOSE) {
+        item = load_word(p, ctx->bytes);
+        if (ctx->options->swap) item = swap_word(item, ctx->bytes);
+    }
+    record_u64(ctx->record, item);
+    mask_print_item(ctx->out, ctx->options->mode, ctx->bytes, item);
+}
+
+void mask_print_summary(const char *filename, uint64_t mask, const Mask_options *options,
+                        uint64_t matches, uint64_t total, Out_buffer *out) {
+    if (options->mode == MASK_OFFSETS_BIN) {
+        uint64_t terminator = UINT64_MAX;
+        out_str(out, (const char *)&terminator, sizeof(terminator));
+    } else {
+        out_printf(out, "Файл %s: Найдено %llu совпадений из %llu (маска: 0x%0*llX)\n", filename,
+                   (unsigned long long)matches, (unsigned long long)total,
+                   2 << options->width, (unsigned long long)mask);
+    }
+}
+
+static int mask_chunk(void *arg, const uint8_t *data, size_t len, uint64_t offset) {
+    Mask_ctx *ctx = (Mask_ctx *)arg;
+    uint64_t stride = ctx->options->stride;
+    uint64_t end = offset + len;
+
+    if (ctx->next_record < offset || ctx->next_record + ctx->bytes > end) return 0;
+
+    uint64_t records = (end - ctx->next_record - ctx->bytes) / stride + 1;
+    const uint8_t *p = data + (ctx->next_record - offset);
+    int report = ctx->options->mode != MASK_COUNT;
+
+    uint64_t i = 0;
+    for (; i + MASK_GROUP <= records; i += MASK_GROUP) {
+        const uint8_t *group = p + i * stride;
+        uint64_t bits = ctx->kernel(group, ctx->native_mask, stride);
+        ctx->matches += __builtin_popcountll(bits);
+        while (report && bits) {
+            int k = __builtin_ctzll(bits);
+            mask_report(ctx, ctx->next_record + (i + k) * stride, group + k * stride);
+            bits &= bits - 1;
+        }
+    }
+
+    for (; i < records; i++) {
+        const uint8_t *record = p + i * stride;
+        uint64_t value = load_word(record, ctx->bytes);
+        if ((value & ctx->native_mask) == ctx->native_mask) {
+            ctx->matches++;
+            if (report) mask_report(ctx, ctx->next_record + i * stride, record);
+        }
+    }
+
+    ctx->total += records;
+    ctx->next_record += records * stride;
+    return 0;
+}
+
+void mask_ctx_init(Mask_ctx *ctx, uint64_t mask, const Mask_options *options, Out_buffer *out) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->options = options;
+    ctx->mask = mask;
+    ctx->bytes = 1 << options->width;
+    ctx->native_mask = options->swap ? swap_word(mask, ctx->bytes) : mask;
+    ctx->kernel = options->stride == (uint64_t)ctx->bytes ? mask_packed_kernels[options->width]
+                                                           : mask_strided_kernels[options->width];
+    ctx->next_record = options->start;
+    ctx->out = out;
+}
+
+int mask_operation(const char* filename, uint64_t mask, const Mask_options *options, Out_buffer *out,
+                   Result_record *record) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
+        return -1;
+    }
+
+    Mask_ctx ctx;
+    mask_ctx_init(&ctx, mask, options, out);
+    ctx.record = record;
+    int status = scan_fd(fd, ctx.bytes - 1, mask_chunk, &ctx);
+    if (status != 0) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
+    }
+
+    record_u64(record, ctx.matches);
+    record_u64(record, ctx.total);
+    mask_print_summary(filename, mask, options, ctx.matches, ctx.total, out);
+    close(fd);
+    return status;
+}
+
+int mask_render_cached(const char *filename, uint64_t mask, const Mask_options *options,
+                       const uint8_t *data, size_t len, Out_buffer *out) {
+    if (len < 2 * sizeof(uint64_t) || len % sizeof(uint64_t) != 0) return -1;
+
+    uint64_t items = len / sizeof(uint64_t) - 2;
+    uint64_t matches, total;
+    memcpy(&matches, data + len - 2 * sizeof(uint64_t), sizeof(matches));
+    memcpy(&total, data + len - sizeof(uint64_t), sizeof(total));
+    if (items != (options->mode == MASK_COUNT ? 0 : matches)) return -1;
+
+    for (uint64_t i = 0; i < items; i++) {
+        uint64_t item;
+        memcpy(&item, data + i * sizeof(item), sizeof(item));
+        mask_print_item(out, options->mode, 1 << options->width, item);
+    }
+    mask_print_summary(filename, mask, options, matches, total, out);
+    return 0;
+}
+
+static int copy_fallback_errno(int err) {
+    return err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EINVAL ||
+           err == ENOTTY || err == EBADF || err == EPERM;
+}
+
+static int copy_with_copy_file_range(int src_fd, int dst_fd) {
+    uint64_t copied = 0;
+    while (1) {
+        ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, 1 << 30, 0);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return copied == 0 && copy_fallback_errno(errno) ? 1 : -1;
+        }
+        if (n == 0) return 0;
+        copied += n;
+    }
+}
+
+static int copy_with_sendfile(int src_fd, int dst_fd) {
+    uint64_t copied = 0;
+    while (1) {
+        ssize_t n = sendfile(dst_fd, src_fd, NULL, 1 << 30);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return copied == 0 && copy_fallback_errno(errno) ? 1 : -1;
+        }
+        if (n == 0) return 0;
+        copied += n;
+    }
+}
+
+static int copy_with_buffer(int src_fd, int dst_fd) {
+    Io_backend *io = io_backend_get();
+    Io_stream stream;
+    if (!io || io_stream_open(&stream, io, src_fd, 0) != 0) {
+        return -1;
+    }
+
+    const uint8_t *data;
+    uint64_t offset;
+    ssize_t len;
+    while ((len = io_stream_next(&stream, &data, &offset)) > 0) {
+        if (write_all(dst_fd, (const char *)data, len) != 0) {
+            len = -1;
+            break;
+        }
+    }
+
+    io_stream_close(&stream);
+    return len == 0 ? 0 : -1;
+}
+
+int copy_file(const char* src, const char* dst, Out_buffer *out) {
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", src);
+        return -1;
+    }
+
+    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst_fd == -1) {
+        fprintf(stderr, "Ошибка создания файла %s\n", dst);
+        close(src_fd);
+        return -1;
+    }
+
+    struct stat st;
+    int regular = fstat(src_fd, &st) == 0 && S_ISREG(st.st_mode);
+    const char *method = NULL;
+    int result = 1;
+
+    if (regular && ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        method = "reflink";
+        result = 0;
+    }
+    if (result > 0 && regular) {
+        method = "copy_file_range";
+        result = copy_with_copy_file_range(src_fd, dst_fd);
+    }
+    if (result > 0) {
+        method = "sendfile";
+        result = copy_with_sendfile(src_fd, dst_fd);
+    }
+    if (result > 0) {
+        method = "read/write";
+        result = copy_with_buffer(src_fd, dst_fd);
+    }
+
+    close(src_fd);
+    if (close(dst_fd) == -1) result = -1;
+    if (result != 0) {
+        fprintf(stderr, "Ошибка записи в файл %s\n", dst);
+        return -1;
+    }
+    out_printf(out, "Создана копия: %s (%s)\n", dst, method);
+    return 0;
+}
+
+int copy_file_fanout(const char *src, int copies, Out_buffer *out) {
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", src);
+        return -1;
+    }
+    posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Io_backend *io = io_backend_get();
+    Io_stream stream;
+    int *dst_fds = malloc(copies * sizeof(int));
+    if (!io || !dst_fds || io_stream_open(&stream, io, src_fd, 0) != 0) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        free(dst_fds);
+        close(src_fd);
+        return -1;
+    }
+
+    int status = 0;
+    int opened = 0;
+    for (; opened < copies; opened++) {
+        char dst[PATH_MAX];
+        snprintf(dst, sizeof(dst), "%s_%d", src, opened + 1);
+        dst_fds[opened] = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (dst_fds[opened] == -1) {
+            fprintf(stderr, "Ошибка создания файла %s\n", dst);
+            status = -1;
+            break;
+        }
+    }
+
+    const uint8_t *buffer;
+    uint64_t offset;
+    while (status == 0) {
+        ssize_t bytes_read = io_stream_next(&stream, &buffer, &offset);
+        if (bytes_read == -1) {
+            fprintf(stderr, "Ошибка чтения файла %s\n", src);
+            status = -1;
+            break;
+        }
+        if (bytes_read == 0) break;
+
+        for (int k = 0; k < copies && status == 0; k++) {
+            ssize_t done = 0;
+            while (done < bytes_read) {
+                ssize_t written = pwrite(dst_fds[k], buffer + done, bytes_read - done, offset + done);
+                if (written == -1) {
+                    if (errno == EINTR) continue;
+                    fprintf(stderr, "Ошибка записи в файл %s_%d\n", src, k + 1);
+                    status = -1;
+                    break;
+                }
+                done += written;
+            }
+        }
+    }
+
+    for (int k = 0; k < opened; k++) {
+        if (close(dst_fds[k]) == -1) status = -1;
+    }
+    if (status == 0) {
+        for (int k = 0; k < copies; k++) {
+            out_printf(out, "Создана копия: %s_%d (fanout)\n", src, k + 1);
+        }
+    }
+
+    io_stream_close(&stream);
+    free(dst_fds);
+    close(src_fd);
+    return status;
+}
+
+typedef struct {
+    uint8_t *needle;
+    size_t len;
+    size_t skip[256];
+} Searcher;
+
+typedef const uint8_t *(*Search_kernel)(const Searcher *s, const uint8_t *hay, size_t len);
+
+static const uint8_t *search_short_scalar(const Searcher *s, const uint8_t *hay, size_t len) {
+    if (len < s->len) return NULL;
+    const uint8_t *p = hay;
+    const uint8_t *end = hay + len - s->len + 1;
+    while (p < end) {
+        p = memchr(p, s->needle[0], end - p);
+        if (!p) return NULL;
+        if (p[s->len - 1] == s->needle[s->len - 1] && memcmp(p, s->needle, s->len) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const uint8_t *search_short_sse2(const Searcher *s, const uint8_t *hay, size_t len) {
+    size_t m = s->len;
+    const __m128i first = _mm_set1_epi8(s->needle[0]);
+    const __m128i last = _mm_set1_epi8(s->needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                        _mm_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(hay + i + bit + 1, s->needle + 1, m - 2) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return search_short_scalar(s, hay + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *search_short_avx2(const Searcher *s, const uint8_t *hay, size_t len) {
+    size_t m = s->len;
+    const __m256i first = _mm256_set1_epi8(s->needle[0]);
+    const __m256i last = _mm256_set1_epi8(s->needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                              _mm256_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(hay + i + bit + 1, s->needle + 1, m - 2) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return search_short_scalar(s, hay + i, len - i);
+}
+#endif
+
+static Search_kernel search_short = search_short_scalar;
+
+void select_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        xor_kernel = xor_kernel_avx2;
+        xor_wide_kernel = xor_wide_avx2;
+        search_short = search_short_avx2;
+        mask_packed_kernels[MASK_W8] = mask_kernel8_avx2;
+        mask_packed_kernels[MASK_W16] = mask_kernel16_avx2;
+        mask_packed_kernels[MASK_W32] = mask_kernel32_avx2;
+        mask_packed_kernels[MASK_W64] = mask_kernel64_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        xor_kernel = xor_kernel_sse2;
+        xor_wide_kernel = xor_wide_sse2;
+        search_short = search_short_sse2;
+        mask_packed_kernels[MASK_W8] = mask_kernel8_sse2;
+        mask_packed_kernels[MASK_W16] = mask_kernel16_sse2;
+        mask_packed_kernels[MASK_W32] = mask_kernel32_sse2;
+        mask_packed_kernels[MASK_W64] = mask_kernel64_sse2;
+    }
+#endif
+}
+
+static const uint8_t *search_horspool(const Searcher *s, const uint8_t *hay, size_t len) {
+    size_t m = s->len;
+    uint8_t last = s->needle[m - 1];
+    size_t i = 0;
+    while (i + m <= len) {
+        uint8_t c = hay[i + m - 1];
+        if (c == last && memcmp(hay + i, s->needle, m - 1) == 0) {
+            return hay + i;
+        }
+        i += s->skip[c];
+    }
+    return NULL;
+}
+
+void searcher_init(Searcher *s, uint8_t *needle, size_t len) {
+    s->needle = needle;
+    s->len = len;
+    if (len <= SEARCH_SHORT_MAX) return;
+
+    for (int c = 0; c < 256; c++) {
+        s->skip[c] = len;
+    }
+    for (size_t i = 0; i + 1 < len; i++) {
+        s->skip[needle[i]] = len - 1 - i;
+    }
+}
+
+const uint8_t *searcher_find(const Searcher *s, const uint8_t *hay, size_t len) {
+    if (s->len == 0) return len > 0 ? hay : NULL;
+    if (len < s->len) return NULL;
+    if (s->len == 1) return memchr(hay, s->needle[0], len);
+    if (s->len <= SEARCH_SHORT_MAX) return search_short(s, hay, len);
+    return search_horspool(s, hay, len);
+}
+
+typedef struct {
+    const Searcher *searcher;
+    int found;
+} Find_ctx;
+
+static int find_chunk(void *arg, const uint8_t *data, size_t len, uint64_t offset) {
+    Find_ctx *ctx = (Find_ctx *)arg;
+    (void)offset;
+    if (searcher_find(ctx->searcher, data, len) != NULL) {
+        ctx->found = 1;
+        return 1;
+    }
+    return 0;
+}
+
+uint8_t *unescape_pattern(const char *search_str, size_t *len) {
+    uint8_t *processed_str = malloc(strlen(search_str) + 1);
+    if (!processed_str) return NULL;
+
+    size_t j = 0;
+    for (int i = 0; search_str[i]; i++) {
+        if (search_str[i] == '\\' && search_str[i+1] == 'n') {
+            processed_str[j++] = '\n';
+            i++;
+        } else {
+            processed_str[j++] = search_str[i];
+        }
+    }
+    processed_str[j] = '\0';
+    *len = j;
+    return processed_str;
+}
+
+void print_pattern(Out_buffer *out, const char *search_str) {
+    for (const char *p = search_str; *p; p++) {
+        if (*p == '\n') out_str(out, "\\n", 2);
+        else if (*p == '\\') out_str(out, "\\\\", 2);
+        else out_char(out, *p);
+    }
+}
+
+void get_full_path(const char *filename, char *full_path, size_t size) {
+    if (getcwd(full_path, size)) {
+        strncat(full_path, "/", size - strlen(full_path) - 1);
+        strncat(full_path, filename, size - strlen(full_path) - 1);
+    } else {
+        snprintf(full_path, size, "%s", filename);
+    }
+}
+
+void find_print_first(const char *filename, const char *search_str, int found, Out_buffer *out) {
+    char full_path[PATH_MAX];
+    get_full_path(filename, full_path, sizeof(full_path));
+
+    if (found) {
+        out_printf(out, "Найдено в: %s\n", full_path);
+    } else {
+        out_printf(out, "Не найдено '");
+        print_pattern(out, search_str);
+        out_printf(out, "' в файле: %s\n", filename);
+    }
+}
+
+int find_in_file(const char* filename, const char* search_str, Out_buffer *out, Result_record *record) {
+    size_t j;
+    uint8_t *processed_str = unescape_pattern(search_str, &j);
+    if (!processed_str) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        return -1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
+        free(processed_str);
+        return -1;
+    }
+
+    Searcher searcher;
+    searcher_init(&searcher, processed_str, j);
+    Find_ctx ctx = { &searcher, 0 };
+    int status = scan_fd(fd, j > 0 ? j - 1 : 0, find_chunk, &ctx);
+    if (status == -1) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
+    }
+    uint8_t found = ctx.found;
+    record_put(record, &found, sizeof(found));
+    find_print_first(filename, search_str, found, out);
+
+    free(processed_str);
+    close(fd);
+    return status;
+}
+
+typedef struct {
+    char **raw;
+    uint8_t **bytes;
+    size_t *lens;
+    int count;
+    int capacity;
+} Pattern_list;
+
+int pattern_list_add(Pattern_list *list, const char *raw) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 8;
+        char **new_raw = realloc(list->raw, capacity * sizeof(char *));
+        if (!new_raw) return -1;
+        list->raw = new_raw;
+        uint8_t **new_bytes = realloc(list->bytes, capacity * sizeof(uint8_t *));
+        if (!new_bytes) return -1;
+        list->bytes = new_bytes;
+        size_t *new_lens = realloc(list->lens, capacity * sizeof(size_t));
+        if (!new_lens) return -1;
+        list->lens = new_lens;
+        list->capacity = capacity;
+    }
+
+    list->raw[list->count] = strdup(raw);
+    list->bytes[list->count] = unescape_pattern(raw, &list->lens[list->count]);
+    if (!list->raw[list->count] || !list->bytes[list->count]) return -1;
+    list->count++;
+    return 0;
+}
+
+int pattern_list_load(Pattern_list *list, const char *path) {
+    FILE *file = fopen(path, "r");
     if (!file) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &capacity, file)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+        if (len == 0) continue;
+        if (pattern_list_add(list, line) != 0) {
+            free(line);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+void pattern_list_free(Pattern_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->raw[i]);
+        free(list->bytes[i]);
+    }
+    free(list->raw);
+    free(list->bytes);
+    free(list->lens);
+    memset(list, 0, sizeof(*list));
+}
+
+typedef struct {
+    int32_t *next;
+    uint8_t classes[256];
+    int class_count;
+    int32_t root[256];
+    int32_t *edge_offset;
+    int32_t *edge_target;
+    uint8_t *edge_byte;
+    int32_t *fail;
+    int32_t *dict;
+    uint8_t *terminal;
+    int32_t *pattern_state;
+    int32_t *first_pattern;
+    int32_t *next_pattern;
+    int state_count;
+    int terminal_count;
+} Aho_corasick;
+
+static int32_t aho_corasick_child(const Aho_corasick *ac, int32_t state, uint8_t c) {
+    if (state == 0) return ac->root[c];
+    int32_t lo = ac->edge_offset[state];
+    int32_t hi = ac->edge_offset[state + 1];
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (ac->edge_byte[mid] < c) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < ac->edge_offset[state + 1] && ac->edge_byte[lo] == c ? ac->edge_target[lo] : -1;
+}
+
+static inline int32_t aho_corasick_step(const Aho_corasick *ac, int32_t state, uint8_t c) {
+    if (ac->next) return ac->next[(size_t)state * ac->class_count + ac->classes[c]];
+    while (state != 0) {
+        int32_t child = aho_corasick_child(ac, state, c);
+        if (child != -1) return child;
+        state = ac->fail[state];
+    }
+    return ac->root[c];
+}
+
+static int aho_corasick_build_edges(Aho_corasick *ac, const int32_t *first, const int32_t *sibling,
+                                    const int32_t *target, const uint8_t *byte) {
+    ac->edge_offset = malloc((ac->state_count + 1) * sizeof(int32_t));
+    ac->edge_target = malloc(ac->state_count * sizeof(int32_t));
+    ac->edge_byte = malloc(ac->state_count);
+    if (!ac->edge_offset || !ac->edge_target || !ac->edge_byte) return -1;
+
+    int32_t count = 0;
+    for (int32_t state = 0; state < ac->state_count; state++) {
+        ac->edge_offset[state] = count;
+        for (int32_t e = first[state]; e != -1; e = sibling[e]) {
+            int32_t k = count++;
+            while (k > ac->edge_offset[state] && ac->edge_byte[k - 1] > byte[e]) {
+                ac->edge_byte[k] = ac->edge_byte[k - 1];
+                ac->edge_target[k] = ac->edge_target[k - 1];
+                k--;
+            }
+            ac->edge_byte[k] = byte[e];
+            ac->edge_target[k] = target[e];
+        }
+    }
+    ac->edge_offset[ac->state_count] = count;
+    return 0;
+}
+
+static void aho_corasick_build_dense(Aho_corasick *ac, const int32_t *order) {
+    uint8_t bytes[256];
+    ac->class_count = 1;
+    for (int c = 0; c < 256; c++) {
+        if (ac->classes[c]) {
+            ac->classes[c] = ac->class_count;
+            bytes[ac->class_count++] = c;
+        }
+    }
+    if ((uint64_t)ac->state_count * ac->class_count * sizeof(int32_t) > AC_DENSE_MAX) return;
+
+    ac->next = malloc((size_t)ac->state_count * ac->class_count * sizeof(int32_t));
+    if (!ac->next) return;
+
+    for (int i = 0; i < ac->state_count; i++) {
+        int32_t state = order[i];
+        int32_t *row = ac->next + (size_t)state * ac->class_count;
+        const int32_t *fail_row = ac->next + (size_t)ac->fail[state] * ac->class_count;
+        row[0] = 0;
+        for (int k = 1; k < ac->class_count; k++) {
+            int32_t child = aho_corasick_child(ac, state, bytes[k]);
+            row[k] = child != -1 ? child : state == 0 ? 0 : fail_row[k];
+        }
+    }
+}
+
+int aho_corasick_build(Aho_corasick *ac, const Pattern_list *list) {
+    size_t max_states = 1;
+    for (int i = 0; i < list->count; i++) {
+        max_states += list->lens[i];
+    }
+
+    memset(ac, 0, sizeof(*ac));
+    int32_t *first = malloc(max_states * sizeof(int32_t));
+    int32_t *sibling = malloc(max_states * sizeof(int32_t));
+    int32_t *target = malloc(max_states * sizeof(int32_t));
+    uint8_t *byte = malloc(max_states);
+    ac->fail = calloc(max_states, sizeof(int32_t));
+    ac->dict = calloc(max_states, sizeof(int32_t));
+    ac->terminal = calloc(max_states, 1);
+    ac->pattern_state = malloc(list->count * sizeof(int32_t));
+    ac->first_pattern = malloc(max_states * sizeof(int32_t));
+    ac->next_pattern = malloc(list->count * sizeof(int32_t));
+    int status = -1;
+    if (!first || !sibling || !target || !byte || !ac->fail || !ac->dict || !ac->terminal ||
+        !ac->pattern_state || !ac->first_pattern || !ac->next_pattern) {
+        goto done;
+    }
+    memset(ac->first_pattern, -1, max_states * sizeof(int32_t));
+    memset(first, -1, max_states * sizeof(int32_t));
+    memset(ac->root, -1, sizeof(ac->root));
+
+    ac->state_count = 1;
+    int32_t edge_count = 0;
+    for (int i = 0; i < list->count; i++) {
+        int32_t state = 0;
+        for (size_t k = 0; k < list->lens[i]; k++) {
+            uint8_t c = list->bytes[i][k];
+            int32_t child = -1;
+            if (state == 0) {
+                child = ac->root[c];
+            } else {
+                for (int32_t e = first[state]; e != -1 && child == -1; e = sibling[e]) {
+                    if (byte[e] == c) child = target[e];
+                }
+            }
+            if (child == -1) {
+                child = ac->state_count++;
+                if (state == 0) {
+                    ac->root[c] = child;
+                } else {
+                    byte[edge_count] = c;
+                    target[edge_count] = child;
+                    sibling[edge_count] = first[state];
+                    first[state] = edge_count++;
+                }
+                ac->classes[c] = 1;
+            }
+            state = child;
+        }
+        if (state != 0 && !ac->terminal[state]) {
+            ac->terminal[state] = 1;
+            ac->terminal_count++;
+        }
+        ac->pattern_state[i] = state;
+        ac->next_pattern[i] = -1;
+    }
+
+    for (int i = list->count - 1; i >= 0; i--) {
+        int32_t state = ac->pattern_state[i];
+        ac->next_pattern[i] = ac->first_pattern[state];
+        ac->first_pattern[state] = i;
+    }
+
+    if (aho_corasick_build_edges(ac, first, sibling, target, byte) != 0) goto done;
+    free(first);
+    free(sibling);
+    free(target);
+    free(byte);
+    first = sibling = target = NULL;
+    byte = NULL;
+
+    int32_t *queue = malloc(ac->state_count * sizeof(int32_t));
+    if (!queue) goto done;
+    int head = 1, tail = 1;
+
+    queue[0] = 0;
+    for (int c = 0; c < 256; c++) {
+        int32_t child = ac->root[c];
+        if (child == -1) {
+            ac->root[c] = 0;
+        } else {
+            ac->fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+
+    while (head < tail) {
+        int32_t state = queue[head++];
+        int32_t fail = ac->fail[state];
+        ac->dict[state] = ac->terminal[fail] ? fail : ac->dict[fail];
+        for (int32_t e = ac->edge_offset[state]; e < ac->edge_offset[state + 1]; e++) {
+            int32_t child = ac->edge_target[e];
+            ac->fail[child] = aho_corasick_step(ac, fail, ac->edge_byte[e]);
+            queue[tail++] = child;
+        }
+    }
+
+    aho_corasick_build_dense(ac, queue);
+    free(queue);
+    status = 0;
+
+done:
+    free(first);
+    free(sibling);
+    free(target);
+    free(byte);
+    return status;
+}
+
+void aho_corasick_free(Aho_corasick *ac) {
+    free(ac->next);
+    free(ac->edge_offset);
+    free(ac->edge_target);
+    free(ac->edge_byte);
+    free(ac->fail);
+    free(ac->dict);
+    free(ac->terminal);
+    free(ac->pattern_state);
+    free(ac->first_pattern);
+    free(ac->next_pattern);
+    memset(ac, 0, sizeof(*ac));
+}
+
+typedef struct {
+    const Aho_corasick *ac;
+    int32_t state;
+    uint8_t *seen;
+    int seen_count;
+    int nonempty;
+} Multi_find_ctx;
+
+static int multi_find_chunk(void *arg, const uint8_t *data, size_t len, uint64_t offset) {
+    Multi_find_ctx *ctx = (Multi_find_ctx *)arg;
+    const Aho_corasick *ac = ctx->ac;
+    int32_t state = ctx->state;
+    (void)offset;
+
+    if (len > 0) ctx->nonempty = 1;
+    for (size_t i = 0; i < len; i++) {
+        state = aho_corasick_step(ac, state, data[i]);
+        int32_t t = ac->terminal[state] ? state : ac->dict[state];
+        while (t > 0 && !ctx->seen[t]) {
+            ctx->seen[t] = 1;
+            ctx->seen_count++;
+            t = ac->dict[t];
+        }
+        if (ctx->seen_count == ac->terminal_count) {
+            ctx->state = state;
+            return 1;
+        }
+    }
+
+    ctx->state = state;
+    return 0;
+}
+
+void find_print_patterns(const char *filename, const Pattern_list *list, const uint8_t *found,
+                         Out_buffer *out) {
+    char full_path[PATH_MAX];
+    get_full_path(filename, full_path, sizeof(full_path));
+
+    for (int i = 0; i < list->count; i++) {
+        if (found[i]) {
+            out_printf(out, "Найдено '");
+            print_pattern(out, list->raw[i]);
+            out_printf(out, "' в: %s\n", full_path);
+        } else {
+            out_printf(out, "Не найдено '");
+            print_pattern(out, list->raw[i]);
+            out_printf(out, "' в файле: %s\n", filename);
+        }
+    }
+}
+
+int find_patterns_in_file(const char *filename, const Aho_corasick *ac, const Pattern_list *list,
+                          Out_buffer *out, Result_record *record) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
         fprintf(stderr, "Ошибка открытия файла %s\n", filename);
-        return;
+        return -1;
+    }
+
+    uint8_t *seen = calloc(ac->state_count, 1);
+    uint8_t *found = malloc(list->count);
+    if (!seen || !found) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        free(seen);
+        free(found);
+        close(fd);
+        return -1;
+    }
+
+    Multi_find_ctx ctx = { ac, 0, seen, 0, 0 };
+    int status = scan_fd(fd, 0, multi_find_chunk, &ctx);
+    if (status == -1) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        int32_t state = ac->pattern_state[i];
+        found[i] = state == 0 ? ctx.nonempty : seen[state];
+    }
+    record_put(record, found, list->count);
+    find_print_patterns(filename, list, found, out);
+
+    free(seen);
+    free(found);
+    close(fd);
+    return status;
+}
+
+enum { FIND_FIRST, FIND_ALL, FIND_COUNT };
+
+typedef struct {
+    int mode;
+    int line_numbers;
+} Find_options;
+
+typedef struct {
+    const Find_options *options;
+    const Pattern_list *list;
+    const Searcher *searcher;
+    const Aho_corasick *ac;
+    const char *filename;
+    size_t filename_len;
+    Out_buffer *out;
+    Result_record *record;
+    uint64_t *counts;
+    size_t *pattern_newlines;
+    int32_t state;
+    uint64_t line;
+    uint64_t line_pos;
+} Match_ctx;
+
+static size_t count_newlines(const uint8_t *data, size_t len) {
+    size_t count = 0;
+    const uint8_t *end = data + len;
+    while ((data = memchr(data, '\n', end - data)) != NULL) {
+        count++;
+        data++;
+    }
+    return count;
+}
+
+static void find_print_match(const char *filename, size_t filename_len, const Pattern_list *list,
+                             const Find_options *options, uint64_t pattern, uint64_t line, uint64_t start,
+                             Out_buffer *out) {
+    out_reserve(out, filename_len + strlen(list->raw[pattern]) + 48);
+    out_str(out, filename, filename_len);
+    out_char(out, ':');
+    if (options->line_numbers) {
+        out_u64(out, line);
+        out_char(out, ':');
+    }
+    out_u64(out, start);
+    if (list->count > 1) {
+        out_char(out, ':');
+        out_str(out, list->raw[pattern], strlen(list->raw[pattern]));
+    }
+    out_char(out, '\n');
+}
+
+static void report_match(Match_ctx *ctx, const uint8_t *data, uint64_t offset, uint64_t end, int pattern) {
+    ctx->counts[pattern]++;
+    if (ctx->options->mode != FIND_ALL) return;
+
+    uint64_t line = 0;
+    if (ctx->options->line_numbers) {
+        ctx->line += count_newlines(data + (ctx->line_pos - offset), end - ctx->line_pos);
+        ctx->line_pos = end;
+        line = ctx->line - ctx->pattern_newlines[pattern] + 1;
     }
+    uint64_t start = end - ctx->list->lens[pattern];
+    record_u64(ctx->record, pattern);
+    record_u64(ctx->record, line);
+    record_u64(ctx->record, start);
+    find_print_match(ctx->filename, ctx->filename_len, ctx->list, ctx->options, pattern, line, start, ctx->out);
+}
 
-    if (N == 2) {
-        uint8_t xor_result = 0;
-        uint8_t byte;
-        int nibble_count = 0;
+static void find_print_counts(const char *filename, const Pattern_list *list, const uint64_t *counts,
+                              Out_buffer *out) {
+    size_t filename_len = strlen(filename);
+    for (int i = 0; i < list->count; i++) {
+        out_reserve(out, filename_len + strlen(list->raw[i]) + 64);
+        out_str(out, "Файл ", strlen("Файл "));
+        out_str(out, filename, filename_len);
+        out_str(out, ": найдено ", strlen(": найдено "));
+        out_u64(out, counts[i]);
+        out_str(out, " совпадений '", strlen(" совпадений '"));
+        out_str(out, list->raw[i], strlen(list->raw[i]));
+        out_str(out, "'\n", 2);
+    }
+}
 
-        while (fread(&byte, 1, 1, file) == 1) {
-            uint8_t high_nibble = byte >> 4;
-            uint8_t low_nibble = byte & 0x0F;
-            
-            xor_result ^= high_nibble;
-            xor_result ^= low_nibble;
-            nibble_count += 2;
-        }
+static int match_chunk(void *arg, const uint8_t *data, size_t len, uint64_t offset) {
+    Match_ctx *ctx = (Match_ctx *)arg;
 
-        if (nibble_count % 2 != 0) {
-            xor_result ^= 0x00;
+    if (ctx->searcher) {
+        size_t m = ctx->searcher->len;
+        const uint8_t *p = data;
+        const uint8_t *end = data + len;
+        while ((p = searcher_find(ctx->searcher, p, end - p)) != NULL) {
+            report_match(ctx, data, offset, offset + (p - data) + m, 0);
+            p++;
+        }
+    } else {
+        const Aho_corasick *ac = ctx->ac;
+        int32_t state = ctx->state;
+        for (size_t i = 0; i < len; i++) {
+            state = aho_corasick_step(ac, state, data[i]);
+            int32_t t = ac->terminal[state] ? state : ac->dict[state];
+            while (t > 0) {
+                for (int32_t k = ac->first_pattern[t]; k != -1; k = ac->next_pattern[k]) {
+                    report_match(ctx, data, offset, offset + i + 1, k);
+                }
+                t = ac->dict[t];
+            }
         }
+        ctx->state = state;
+    }
 
-        printf("Файл %s: XOR2 результат: %02X\n", filename, xor_result & 0x0F);
-        fclose(file);
-        return;
+    if (ctx->options->line_numbers) {
+        ctx->line += count_newlines(data + (ctx->line_pos - offset), offset + len - ctx->line_pos);
+        ctx->line_pos = offset + len;
     }
+    return 0;
+}
 
-    int block_size_bytes = (1 << N) / 8;
-    uint8_t *buffer = (uint8_t*)malloc(block_size_bytes);
-    if (!buffer) {
-        fprintf(stderr, "Ошибка выделения памяти\n");
-        fclose(file);
-        return;
+int find_matches_in_file(const char *filename, const Pattern_list *list, const Aho_corasick *ac,
+                          const Find_options *options, Out_buffer *out, Result_record *record) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
+        return -1;
     }
 
-    uint8_t *xor_result = (uint8_t*)calloc(block_size_bytes, 1);
-    if (!xor_result) {
+    uint64_t *counts = calloc(list->count, sizeof(uint64_t));
+    size_t *pattern_newlines = calloc(list->count, sizeof(size_t));
+    if (!counts || !pattern_newlines) {
         fprintf(stderr, "Ошибка выделения памяти\n");
-        free(buffer);
-        fclose(file);
-        return;
+        free(counts);
+        free(pattern_newlines);
+        close(fd);
+        return -1;
+    }
+    for (int i = 0; i < list->count; i++) {
+        pattern_newlines[i] = count_newlines(list->bytes[i], list->lens[i]);
     }
 
-    while (1) {
-        size_t bytes_read = fread(buffer, 1, block_size_bytes, file);
-        if (bytes_read == 0) break;
+    Searcher searcher;
+    Match_ctx ctx = {0};
+    ctx.options = options;
+    ctx.list = list;
+    ctx.filename = filename;
+    ctx.filename_len = strlen(filename);
+    ctx.out = out;
+    ctx.record = record;
+    ctx.counts = counts;
+    ctx.pattern_newlines = pattern_newlines;
 
-        if (bytes_read < block_size_bytes) {
-            memset(buffer + bytes_read, 0, block_size_bytes - bytes_read);
-        }
+    size_t overlap = 0;
+    if (list->count == 1) {
+        searcher_init(&searcher, list->bytes[0], list->lens[0]);
+        ctx.searcher = &searcher;
+        overlap = list->lens[0] - 1;
+    } else {
+        ctx.ac = ac;
+    }
 
-        for (int i = 0; i < block_size_bytes; i++) {
-            xor_result[i] ^= buffer[i];
-        }
+    int status = scan_fd(fd, overlap, match_chunk, &ctx);
+    if (status == -1) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
     }
 
-    printf("Файл %s: XOR%d результат: ", filename, N);
-    for (int i = 0; i < block_size_bytes; i++) {
-        printf("%02X", xor_result[i]);
+    record_put(record, counts, list->count * sizeof(uint64_t));
+    if (options->mode == FIND_COUNT) {
+        find_print_counts(filename, list, counts, out);
     }
-    printf("\n");
 
-    free(buffer);
-    free(xor_result);
-    fclose(file);
+    free(counts);
+    free(pattern_newlines);
+    close(fd);
+    return status;
 }
 
-void mask_operation(const char* filename, uint32_t mask) {
-    FILE *file = fopen(filename, "rb");  
-    if (!file) {
-        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
-        return;
+int find_render_cached(const char *filename, const char *search_str, const Pattern_list *list,
+                       const Find_options *options, const uint8_t *data, size_t len, Out_buffer *out) {
+    if (options->mode == FIND_FIRST && list->count > 1) {
+        if (len != (size_t)list->count) return -1;
+        find_print_patterns(filename, list, data, out);
+        return 0;
+    }
+    if (options->mode == FIND_FIRST) {
+        if (len != 1) return -1;
+        find_print_first(filename, search_str, data[0], out);
+        return 0;
+    }
+
+    size_t counts_len = list->count * sizeof(uint64_t);
+    size_t item_len = 3 * sizeof(uint64_t);
+    if (len < counts_len || (len - counts_len) % item_len != 0) return -1;
+    size_t items = (len - counts_len) / item_len;
+    if (options->mode == FIND_COUNT && items != 0) return -1;
+    for (size_t i = 0; i < items; i++) {
+        uint64_t item[3];
+        memcpy(item, data + i * item_len, item_len);
+        if (item[0] >= (uint64_t)list->count) return -1;
+    }
+
+    size_t filename_len = strlen(filename);
+    for (size_t i = 0; i < items; i++) {
+        uint64_t item[3];
+        memcpy(item, data + i * item_len, item_len);
+        find_print_match(filename, filename_len, list, options, item[0], item[1], item[2], out);
+    }
+    if (options->mode == FIND_COUNT) {
+        uint64_t *counts = malloc(counts_len);
+        if (!counts) return -1;
+        memcpy(counts, data + len - counts_len, counts_len);
+        find_print_counts(filename, list, counts, out);
+        free(counts);
     }
+    return 0;
+}
 
-    uint32_t value;
-    int matches = 0;
-    int total = 0;
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t slot_count;
+    uint64_t log_size;
+    uint64_t clock;
+    uint64_t log_tail;
+    uint8_t reserved[CACHE_HEADER_SIZE - 48];
+} Cache_header;
 
-    while (fread(&value, sizeof(uint32_t), 1, file) == 1) {
-        total++;
-        if ((value & mask) == mask) {
-            matches++;
-            printf("Совпадение: 0x%08x\n", value);
-        }
+typedef struct {
+    uint32_t seq;
+    uint32_t len;
+    uint64_t tag;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t last_used;
+    uint64_t log_pos;
+    uint64_t checksum;
+} Cache_slot;
+
+typedef struct {
+    uint64_t tag;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+} Cache_key;
+
+typedef struct {
+    int fd;
+    size_t map_size;
+    Cache_header *header;
+    Cache_slot *slots;
+    uint8_t *log;
+    uint64_t slot_count;
+    uint64_t log_size;
+} Result_cache;
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001B3ULL;
     }
+    return hash;
+}
 
-    printf("Файл %s: Найдено %d совпадений из %d (маска: 0x%08X)\n", filename, matches, total, mask);
-    fclose(file);
+uint64_t hash_string(uint64_t hash, const char *str) {
+    return hash_bytes(hash, str, strlen(str) + 1);
 }
 
-void copy_file(const char* src, const char* dst) {
-    int src_fd = open(src, O_RDONLY);
-    if (src_fd == -1) {
-        fprintf(stderr, "Ошибка открытия файла %s\n", src);
-        return;
+static uint64_t hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+void cache_key_init(Cache_key *key, const struct stat *st, uint64_t tag) {
+    key->tag = tag;
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static uint64_t cache_key_hash(const Cache_key *key) {
+    uint64_t h = hash_mix(key->tag ^ hash_mix(key->dev));
+    h = hash_mix(h ^ key->ino);
+    h = hash_mix(h ^ key->size);
+    return hash_mix(h ^ (uint64_t)key->mtime_ns);
+}
+
+static int cache_slot_matches(const Cache_slot *slot, const Cache_key *key) {
+    return slot->tag == key->tag && slot->dev == key->dev && slot->ino == key->ino &&
+           slot->size == key->size && slot->mtime_ns == key->mtime_ns;
+}
+
+static uint64_t cache_map_size(uint64_t slot_count, uint64_t log_size) {
+    return CACHE_HEADER_SIZE + slot_count * sizeof(Cache_slot) + log_size;
+}
+
+static void result_cache_recover(Result_cache *cache) {
+    for (uint64_t i = 0; i < cache->slot_count; i++) {
+        if (cache->slots[i].seq & 1) {
+            cache->slots[i].seq = 0;
+        }
     }
+}
 
-    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dst_fd == -1) {
-        fprintf(stderr, "Ошибка создания файла %s\n", dst);
-        close(src_fd);
-        return;
+Result_cache *result_cache_open(const char *path, uint64_t slot_count) {
+    uint64_t count = 64;
+    while (count < slot_count) count <<= 1;
+
+    Result_cache *cache = calloc(1, sizeof(Result_cache));
+    if (!cache) return NULL;
+
+    cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (cache->fd == -1) {
+        free(cache);
+        return NULL;
     }
+    int exclusive = flock(cache->fd, LOCK_EX | LOCK_NB) == 0;
+    if (!exclusive) flock(cache->fd, LOCK_SH);
 
-    char buffer[2048];
-    ssize_t bytes_read, bytes_written;
+    struct stat st;
+    Cache_header header;
+    if (fstat(cache->fd, &st) == -1) goto fail;
 
-    while ((bytes_read = read(src_fd, buffer, sizeof(buffer))) > 0) {
-        bytes_written = write(dst_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            fprintf(stderr, "Ошибка записи в файл %s\n", dst);
-            close(src_fd);
-            close(dst_fd);
-            return;
+    if (st.st_size == 0 && exclusive) {
+        memset(&header, 0, sizeof(header));
+        header.magic = CACHE_MAGIC;
+        header.version = CACHE_VERSION;
+        header.header_size = CACHE_HEADER_SIZE;
+        header.slot_count = count;
+        header.log_size = count * CACHE_LOG_PER_SLOT;
+        if (ftruncate(cache->fd, cache_map_size(header.slot_count, header.log_size)) == -1 ||
+            pwrite(cache->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            goto fail;
         }
+    } else if (pread(cache->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+               header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+               header.header_size != CACHE_HEADER_SIZE || header.slot_count == 0 ||
+               (header.slot_count & (header.slot_count - 1)) != 0 || header.log_size == 0 ||
+               (uint64_t)st.st_size != cache_map_size(header.slot_count, header.log_size)) {
+        goto fail;
     }
 
-    close(src_fd);
-    close(dst_fd);
-    printf("Создана копия: %s\n", dst);
-    return;
+    cache->slot_count = header.slot_count;
+    cache->log_size = header.log_size;
+    cache->map_size = cache_map_size(cache->slot_count, cache->log_size);
+    void *map = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) goto fail;
+
+    cache->header = (Cache_header *)map;
+    cache->slots = (Cache_slot *)((uint8_t *)map + CACHE_HEADER_SIZE);
+    cache->log = (uint8_t *)(cache->slots + cache->slot_count);
+    if (exclusive) {
+        result_cache_recover(cache);
+        flock(cache->fd, LOCK_SH);
+    }
+    return cache;
+
+fail:
+    close(cache->fd);
+    free(cache);
+    return NULL;
+}
+
+void result_cache_close(Result_cache *cache) {
+    if (!cache) return;
+    munmap(cache->header, cache->map_size);
+    close(cache->fd);
+    free(cache);
 }
 
-void *memmem(const void *haystack, size_t haystacklen, const void *needle, size_t needlelen) {
-    if (needlelen == 0) return (void *)haystack;
-    if (haystacklen < needlelen) return NULL;
+static size_t result_cache_max_entry(const Result_cache *cache) {
+    return cache->log_size / 8;
+}
+
+ssize_t result_cache_lookup(Result_cache *cache, const Cache_key *key, Result_record *record) {
+    uint64_t h = cache_key_hash(key);
+    record->len = 0;
+    record->overflow = 0;
+    for (int i = 0; i < CACHE_PROBE; i++) {
+        Cache_slot *slot = &cache->slots[(h + i) & (cache->slot_count - 1)];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || (seq & 1)) continue;
 
-    const char *h = haystack;
-    const char *n = needle;
+        Cache_slot copy;
+        memcpy(&copy, slot, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue;
+        if (!cache_slot_matches(&copy, key) || copy.len > result_cache_max_entry(cache) ||
+            copy.log_pos % cache->log_size + copy.len > cache->log_size) {
+            continue;
+        }
 
-    for (size_t i = 0; i <= haystacklen - needlelen; i++) {
-        if (memcmp(&h[i], n, needlelen) == 0) {
-            return (void *)&h[i];
+        record->len = 0;
+        record_put(record, cache->log + copy.log_pos % cache->log_size, copy.len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&cache->header->log_tail, __ATOMIC_RELAXED);
+        if (record->overflow || tail > copy.log_pos + cache->log_size ||
+            hash_bytes(0xCBF29CE484222325ULL, record->data, record->len) != copy.checksum) {
+            record->overflow = 0;
+            continue;
         }
+
+        __atomic_store_n(&slot->last_used,
+                         __atomic_add_fetch(&cache->header->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        return record->len;
     }
-    return NULL;
+    return -1;
 }
 
-void find_in_file(const char* filename, const char* search_str) {
-    char *processed_str = malloc(strlen(search_str) + 1);
-    int j = 0;
-    for (int i = 0; search_str[i]; i++) {
-        if (search_str[i] == '\\' && search_str[i+1] == 'n') {
-            processed_str[j++] = '\n';
-            i++;
-        } else {
-            processed_str[j++] = search_str[i];
+static uint64_t result_cache_reserve(Result_cache *cache, size_t len) {
+    uint64_t tail = __atomic_load_n(&cache->header->log_tail, __ATOMIC_RELAXED);
+    uint64_t start;
+    do {
+        uint64_t used = tail % cache->log_size;
+        start = used + len > cache->log_size ? tail + (cache->log_size - used) : tail;
+    } while (!__atomic_compare_exchange_n(&cache->header->log_tail, &tail, start + len, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return start;
+}
+
+void result_cache_store(Result_cache *cache, const Cache_key *key, const void *payload, size_t len) {
+    if (len > result_cache_max_entry(cache)) return;
+
+    uint64_t h = cache_key_hash(key);
+    Cache_slot *victim = NULL;
+    uint32_t victim_seq = 0;
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < CACHE_PROBE; i++) {
+        Cache_slot *slot = &cache->slots[(h + i) & (cache->slot_count - 1)];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        if (seq == 0 || cache_slot_matches(slot, key)) {
+            victim = slot;
+            victim_seq = seq;
+            break;
+        }
+        uint64_t used = __atomic_load_n(&slot->last_used, __ATOMIC_RELAXED);
+        if (used < oldest) {
+            oldest = used;
+            victim = slot;
+            victim_seq = seq;
         }
     }
-    processed_str[j] = '\0';
+    if (!victim) return;
 
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
-        free(processed_str);
+    uint64_t pos = result_cache_reserve(cache, len);
+    memcpy(cache->log + pos % cache->log_size, payload, len);
+
+    if (!__atomic_compare_exchange_n(&victim->seq, &victim_seq, victim_seq + 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
         return;
     }
 
-    size_t search_len = j;
-    char buffer[1024];
-    size_t bytes_read;
-    size_t overlap = search_len > 0 ? search_len - 1 : 0;
-    int found = 0;
+    victim->len = len;
+    victim->tag = key->tag;
+    victim->dev = key->dev;
+    victim->ino = key->ino;
+    victim->size = key->size;
+    victim->mtime_ns = key->mtime_ns;
+    victim->log_pos = pos;
+    victim->checksum = hash_bytes(0xCBF29CE484222325ULL, payload, len);
+    victim->last_used = __atomic_add_fetch(&cache->header->clock, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->seq, victim_seq + 2 ? victim_seq + 2 : 2, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    uint64_t offset;
+    uint8_t tail[XOR_CHECKPOINT_TAIL];
+    uint8_t acc[];
+} Xor_checkpoint;
 
-    bytes_read = fread(buffer, 1, sizeof(buffer) - overlap, file);
-    
-    while (!found && bytes_read > 0) {
-        if (memmem(buffer, bytes_read, processed_str, search_len) != NULL) {
-            found = 1;
-            break;
+static int xor_checkpoint_tail(int fd, uint64_t offset, uint8_t *tail) {
+    memset(tail, 0, XOR_CHECKPOINT_TAIL);
+    uint64_t start = offset < XOR_CHECKPOINT_TAIL ? 0 : offset - XOR_CHECKPOINT_TAIL;
+    ssize_t want = offset - start;
+    return pread(fd, tail, want, start) == want ? 0 : -1;
+}
+
+int xor_incremental_operation(const char *filename, int N, Thread_pool *pool,
+                              Result_cache *cache, uint64_t tag, Out_buffer *out, Result_record *record) {
+    size_t width = xor_width(N);
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Ошибка открытия файла %s\n", filename);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return xor_operation(filename, N, pool, out, record);
+    }
+
+    uint8_t *acc = xor_scratch_acquire(width);
+    if (!acc) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        close(fd);
+        return -1;
+    }
+
+    struct stat identity = st;
+    identity.st_size = 0;
+    identity.st_mtim.tv_sec = 0;
+    identity.st_mtim.tv_nsec = 0;
+    Cache_key key;
+    cache_key_init(&key, &identity, tag ^ XOR_CHECKPOINT_SALT);
+
+    size_t checkpoint_size = sizeof(Xor_checkpoint) + width;
+    Result_record stored = {0};
+    stored.limit = checkpoint_size;
+    uint8_t tail[XOR_CHECKPOINT_TAIL];
+    uint64_t offset = 0;
+    if (result_cache_lookup(cache, &key, &stored) == (ssize_t)checkpoint_size) {
+        Xor_checkpoint *checkpoint = (Xor_checkpoint *)stored.data;
+        if (checkpoint->offset <= (uint64_t)st.st_size &&
+            xor_checkpoint_tail(fd, checkpoint->offset, tail) == 0 &&
+            memcmp(tail, checkpoint->tail, XOR_CHECKPOINT_TAIL) == 0) {
+            offset = checkpoint->offset;
+            memcpy(acc, checkpoint->acc, width);
+        }
+    }
+    free(stored.data);
+
+    if (offset < (uint64_t)st.st_size &&
+        xor_fold_fd_range(fd, acc, width, offset, st.st_size - offset, pool) != 0) {
+        fprintf(stderr, "Ошибка чтения файла %s\n", filename);
+        xor_scratch_release();
+        close(fd);
+        return -1;
+    }
+
+    Xor_checkpoint *checkpoint = malloc(checkpoint_size);
+    if (checkpoint) {
+        checkpoint->offset = st.st_size;
+        memcpy(checkpoint->acc, acc, width);
+        if (xor_checkpoint_tail(fd, checkpoint->offset, checkpoint->tail) == 0) {
+            result_cache_store(cache, &key, checkpoint, checkpoint_size);
         }
+        free(checkpoint);
+    }
+    close(fd);
+
+    xor_render(filename, N, acc, width, out, record);
+    xor_scratch_release();
+    return 0;
+}
 
-        if (feof(file)) break;
+enum { OP_XOR, OP_MASK, OP_COPY, OP_FIND };
 
-        if (bytes_read > overlap) {
-            memmove(buffer, buffer + bytes_read - overlap, overlap);
-            bytes_read = overlap;
+typedef struct {
+    int type;
+    int N;
+    uint64_t mask;
+    const char *search_str;
+    const Pattern_list *patterns;
+    const Aho_corasick *ac;
+    const Find_options *find_options;
+    const Mask_options *mask_options;
+    int fanout;
+    Thread_pool *pool;
+    Result_cache *cache;
+    uint64_t cache_tag;
+    int incremental;
+} Operation;
+
+typedef struct {
+    const Operation *op;
+    const char *filename;
+    int copy_num;
+    int status;
+    Out_buffer out;
+    Output_order *order;
+    Wait_group *wg;
+} Job;
+
+uint64_t operation_cache_tag(const Operation *op) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    h = hash_bytes(h, &op->type, sizeof(op->type));
+    h = hash_bytes(h, &op->N, sizeof(op->N));
+
+    if (op->type == OP_MASK) {
+        const Mask_options *m = op->mask_options;
+        h = hash_bytes(h, &op->mask, sizeof(op->mask));
+        h = hash_bytes(h, &m->mode, sizeof(m->mode));
+        h = hash_bytes(h, &m->width, sizeof(m->width));
+        h = hash_bytes(h, &m->swap, sizeof(m->swap));
+        h = hash_bytes(h, &m->start, sizeof(m->start));
+        h = hash_bytes(h, &m->stride, sizeof(m->stride));
+    } else if (op->type == OP_FIND) {
+        h = hash_bytes(h, &op->find_options->mode, sizeof(op->find_options->mode));
+        h = hash_bytes(h, &op->find_options->line_numbers, sizeof(op->find_options->line_numbers));
+        h = hash_string(h, op->search_str ? op->search_str : "");
+        for (int i = 0; i < op->patterns->count; i++) {
+            h = hash_string(h, op->patterns->raw[i]);
         }
+    }
+    return h;
+}
+
+static int run_operation(Job *job, Result_record *record) {
+    const Operation *op = job->op;
 
-        size_t new_read = fread(buffer + bytes_read, 1, sizeof(buffer) - bytes_read, file);
-        if (new_read == 0) break;
-        bytes_read += new_read;
+    if (op->type == OP_XOR && op->incremental) {
+        return xor_incremental_operation(job->filename, op->N, op->pool, op->cache, op->cache_tag,
+                                         &job->out, record);
+    } else if (op->type == OP_XOR) {
+        return xor_operation(job->filename, op->N, op->pool, &job->out, record);
+    } else if (op->type == OP_MASK) {
+        return mask_operation(job->filename, op->mask, op->mask_options, &job->out, record);
+    } else if (op->type == OP_COPY && op->fanout) {
+        return copy_file_fanout(job->filename, op->N, &job->out);
+    } else if (op->type == OP_COPY) {
+        char new_name[PATH_MAX];
+        snprintf(new_name, sizeof(new_name), "%s_%d", job->filename, job->copy_num);
+        return copy_file(job->filename, new_name, &job->out);
+    } else if (op->find_options->mode != FIND_FIRST) {
+        return find_matches_in_file(job->filename, op->patterns, op->ac, op->find_options, &job->out, record);
+    } else if (op->patterns->count > 1) {
+        return find_patterns_in_file(job->filename, op->ac, op->patterns, &job->out, record);
     }
+    return find_in_file(job->filename, op->search_str, &job->out, record);
+}
 
-    char full_path[PATH_MAX];
-    if (getcwd(full_path, sizeof(full_path))) {
-        strncat(full_path, "/", sizeof(full_path) - strlen(full_path) - 1);
-        strncat(full_path, filename, sizeof(full_path) - strlen(full_path) - 1);
+static int render_cached_result(Job *job, const uint8_t *data, size_t len) {
+    const Operation *op = job->op;
+    if (op->type == OP_XOR) {
+        if (len != xor_result_size(op->N)) return -1;
+        xor_print(job->filename, op->N, data, &job->out);
+        return 0;
+    } else if (op->type == OP_MASK) {
+        return mask_render_cached(job->filename, op->mask, op->mask_options, data, len, &job->out);
+    }
+    return find_render_cached(job->filename, op->search_str, op->patterns, op->find_options, data, len,
+                              &job->out);
+}
+
+static int run_cached_operation(Job *job) {
+    const Operation *op = job->op;
+    struct stat before;
+    if (stat(job->filename, &before) == -1) {
+        fprintf(stderr, "Файл %s не существует\n", job->filename);
+        return -1;
+    }
+
+    Cache_key key;
+    cache_key_init(&key, &before, op->cache_tag);
+    Result_record record = {0};
+    record.limit = result_cache_max_entry(op->cache);
+    if (result_cache_lookup(op->cache, &key, &record) >= 0 &&
+        render_cached_result(job, record.data, record.len) == 0) {
+        free(record.data);
+        return 0;
+    }
+
+    record.len = 0;
+    record.overflow = 0;
+    int status = run_operation(job, &record);
+
+    struct stat after;
+    Cache_key check;
+    if (status == 0 && !record.overflow && record.len > 0 && stat(job->filename, &after) == 0) {
+        cache_key_init(&check, &after, key.tag);
+        if (memcmp(&check, &key, sizeof(key)) == 0) {
+            result_cache_store(op->cache, &key, record.data, record.len);
+        }
+    }
+    free(record.data);
+    return status;
+}
+
+static void run_job(void *arg) {
+    Job *job = (Job *)arg;
+    const Operation *op = job->op;
+
+    if (op->cache && op->type != OP_COPY) {
+        job->status = run_cached_operation(job);
+    } else if (!file_exists(job->filename)) {
+        fprintf(stderr, "Файл %s не существует\n", job->filename);
+        job->status = -1;
     } else {
-        strncpy(full_path, filename, sizeof(full_path));
+        job->status = run_operation(job, NULL);
     }
 
-    if (found) {
-        printf("Найдено в: %s\n", full_path);
+    output_order_finish(job->order, &job->out);
+    wait_group_done(job->wg);
+}
+
+enum { SELF_TEST_PIPE = IO_URING + 1, SELF_TEST_KINDS };
+
+static const char *const self_test_names[SELF_TEST_KINDS] = { "mmap", "sync", "uring", "pipe" };
+
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    size_t len;
+} Self_test_pipe;
+
+static void *self_test_writer(void *arg) {
+    Self_test_pipe *pipe = (Self_test_pipe *)arg;
+    for (size_t off = 0; off < pipe->len; off += 4093) {
+        size_t n = pipe->len - off < 4093 ? pipe->len - off : 4093;
+        if (write_all(pipe->fd, (const char *)pipe->data + off, n) != 0) break;
+    }
+    close(pipe->fd);
+    return NULL;
+}
+
+static int self_test_scan(int kind, const char *path, const uint8_t *data, size_t len,
+                          size_t overlap, Chunk_fn fn, void *ctx) {
+    if (kind == IO_MMAP) {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) return -1;
+        Io_config saved = io_config;
+        io_config.kind = IO_MMAP;
+        int status = scan_fd(fd, overlap, fn, ctx);
+        io_config = saved;
+        close(fd);
+        return status;
+    }
+
+    Io_config config = { kind == IO_URING ? IO_URING : IO_SYNC, IO_DEFAULT_QUEUE_DEPTH };
+    Io_backend *io = io_backend_create(&config);
+    if (!io) return -1;
+
+    int fd;
+    int fds[2];
+    pthread_t writer;
+    Self_test_pipe pipe_arg = { -1, data, len };
+    if (kind == SELF_TEST_PIPE) {
+        if (pipe(fds) == -1) {
+            io_backend_destroy(io);
+            return -1;
+        }
+        pipe_arg.fd = fds[1];
+        if (pthread_create(&writer, NULL, self_test_writer, &pipe_arg) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            io_backend_destroy(io);
+            return -1;
+        }
+        fd = fds[0];
     } else {
-        printf("Не найдено '");
-        for (const char *p = search_str; *p; p++) {
-            if (*p == '\n') printf("\\n");
-            else if (*p == '\\') printf("\\\\");
-            else putchar(*p);
+        fd = open(path, O_RDONLY);
+    }
+
+    int status = fd == -1 ? -1 : scan_stream(io, fd, overlap, fn, ctx);
+    if (kind == SELF_TEST_PIPE) {
+        char drain[4096];
+        while (read(fd, drain, sizeof(drain)) > 0) {}
+        pthread_join(writer, NULL);
+    }
+    if (fd != -1) close(fd);
+    io_backend_destroy(io);
+    return status;
+}
+
+static uint64_t self_test_mask_reference(const uint8_t *data, size_t len, const Mask_options *options,
+                                         uint64_t mask) {
+    int bytes = 1 << options->width;
+    uint64_t matches = 0;
+    for (uint64_t r = options->start; r + bytes <= len; r += options->stride) {
+        if ((load_word(data + r, bytes) & mask) == mask) matches++;
+    }
+    return matches;
+}
+
+static int self_test_mask(int fd, const char *path, uint8_t *data, size_t len) {
+    int failures = 0;
+    for (int width = MASK_W16; width < MASK_WIDTHS; width++) {
+        int bytes = 1 << width;
+        uint64_t mask = bytes == 8 ? UINT64_MAX : ((uint64_t)1 << (bytes * 8)) - 1;
+        for (int shift = 1; shift < bytes; shift++) {
+            uint64_t at = STREAM_CHUNK - shift;
+            memset(data, 0, len);
+            memset(data + at, 0xFF, bytes);
+            if (pwrite(fd, data, len, 0) != (ssize_t)len) return failures + 1;
+
+            Mask_options options = { MASK_COUNT, width, 0, 0, bytes + 3 };
+            options.start = at % options.stride;
+            uint64_t expected = self_test_mask_reference(data, len, &options, mask);
+            for (int kind = 0; kind < SELF_TEST_KINDS; kind++) {
+                Mask_ctx ctx;
+                mask_ctx_init(&ctx, mask, &options, NULL);
+                if (self_test_scan(kind, path, data, len, bytes - 1, mask_chunk, &ctx) != 0 ||
+                    ctx.matches != expected || expected != 1) {
+                    fprintf(stderr, "Самопроверка mask%d (%s): %llu совпадений вместо %llu на смещении %llu\n",
+                            bytes * 8, self_test_names[kind], (unsigned long long)ctx.matches,
+                            (unsigned long long)expected, (unsigned long long)at);
+                    failures++;
+                }
+            }
         }
-        printf("' в файле: %s\n", filename);
+    }
+    return failures;
+}
+
+int self_test(void) {
+    static const uint8_t needle[] = "NEEDLEXY";
+    size_t needle_len = sizeof(needle) - 1;
+    size_t len = 2 * STREAM_CHUNK;
+    uint8_t *data = calloc(len, 1);
+
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/1.2laba.XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = data ? mkstemp(path) : -1;
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка создания временного файла\n");
+        free(data);
+        return 1;
     }
 
-    free(processed_str);
-    fclose(file);
+    int failures = 0;
+    for (size_t shift = 1; shift < needle_len; shift++) {
+        uint64_t at = STREAM_CHUNK - shift;
+        memset(data, 0, len);
+        memcpy(data + at, needle, needle_len);
+        if (pwrite(fd, data, len, 0) != (ssize_t)len) {
+            fprintf(stderr, "Ошибка записи в файл %s\n", path);
+            failures++;
+            break;
+        }
+
+        for (int kind = 0; kind < SELF_TEST_KINDS; kind++) {
+            Searcher searcher;
+            searcher_init(&searcher, (uint8_t *)needle, needle_len);
+            Find_ctx ctx = { &searcher, 0 };
+            if (self_test_scan(kind, path, data, len, needle_len - 1, find_chunk, &ctx) != 0 || !ctx.found) {
+                fprintf(stderr, "Самопроверка find (%s): не найдено совпадение на смещении %llu\n",
+                        self_test_names[kind], (unsigned long long)at);
+                failures++;
+            }
+        }
+    }
+
+    failures += self_test_mask(fd, path, data, len);
+    close(fd);
+    unlink(path);
+    free(data);
+    if (failures > 0) {
+        printf("Самопроверка: ошибок %d\n", failures);
+        return 1;
+    }
+    printf("Самопроверка пройдена\n");
+    return 0;
 }
 
 int main(int argc, char **argv) {
-    if (argc < 3) {
+    select_kernels();
+
+    int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0) thread_count = 1;
+    Pattern_list patterns = {0};
+    Find_options find_options = { FIND_FIRST, 0 };
+    int fanout = 0;
+    Mask_options mask_options = { MASK_VERBOSE, MASK_W32, 0, 0, 0 };
+    const char *cache_path = NULL;
+    uint64_t cache_slots = CACHE_DEFAULT_SLOTS;
+    int incremental = 0;
+    static const struct option long_options[] = {
+        { "all", no_argument, NULL, 'a' },
+        { "count", no_argument, NULL, 'c' },
+        { "line-number", no_argument, NULL, 'n' },
+        { "fanout", no_argument, NULL, 'F' },
+        { "offsets", optional_argument, NULL, 'O' },
+        { "width", required_argument, NULL, 'W' },
+        { "endian", required_argument, NULL, 'E' },
+        { "start", required_argument, NULL, 'S' },
+        { "stride", required_argument, NULL, 'T' },
+        { "io", required_argument, NULL, 'I' },
+        { "qd", required_argument, NULL, 'Q' },
+        { "cache", required_argument, NULL, 'C' },
+        { "cache-slots", required_argument, NULL, 'L' },
+        { "incremental", no_argument, NULL, 'A' },
+        { "self-test", no_argument, NULL, 'X' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+j:e:f:n", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                find_options.mode = FIND_ALL;
+                break;
+            case 'c':
+                find_options.mode = FIND_COUNT;
+                mask_options.mode = MASK_COUNT;
+                break;
+            case 'W': {
+                int bits = atoi(optarg);
+                if (bits == 8) mask_options.width = MASK_W8;
+                else if (bits == 16) mask_options.width = MASK_W16;
+                else if (bits == 32) mask_options.width = MASK_W32;
+                else if (bits == 64) mask_options.width = MASK_W64;
+                else {
+                    fprintf(stderr, "Размер слова должен быть 8, 16, 32 или 64\n");
+                    return 1;
+                }
+                break;
+            }
+            case 'E':
+                if (strcmp(optarg, "little") == 0) {
+                    mask_options.swap = __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__;
+                } else if (strcmp(optarg, "big") == 0) {
+                    mask_options.swap = __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__;
+                } else if (strcmp(optarg, "host") == 0) {
+                    mask_options.swap = 0;
+                } else {
+                    fprintf(stderr, "Порядок байт должен быть little, big или host\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                mask_options.start = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                mask_options.stride = strtoull(optarg, NULL, 0);
+                if (mask_options.stride == 0) {
+                    fprintf(stderr, "Шаг записей должен быть положительным\n");
+                    return 1;
+                }
+                break;
+            case 'O':
+                if (!optarg || strcmp(optarg, "text") == 0) mask_options.mode = MASK_OFFSETS_TEXT;
+                else if (strcmp(optarg, "bin") == 0) mask_options.mode = MASK_OFFSETS_BIN;
+                else {
+                    fprintf(stderr, "Неизвестный формат смещений %s (text, bin)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                find_options.line_numbers = 1;
+                break;
+            case 'F':
+                fanout = 1;
+                break;
+            case 'I':
+                if (strcmp(optarg, "mmap") == 0) io_config.kind = IO_MMAP;
+                else if (strcmp(optarg, "sync") == 0) io_config.kind = IO_SYNC;
+                else if (strcmp(optarg, "uring") == 0) io_config.kind = IO_URING;
+                else {
+                    fprintf(stderr, "Неизвестный режим ввода-вывода %s (mmap, sync, uring)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'Q':
+                io_config.queue_depth = atoi(optarg);
+                if (io_config.queue_depth < 2 || io_config.queue_depth > 4096) {
+                    fprintf(stderr, "Глубина очереди должна быть от 2 до 4096\n");
+                    return 1;
+                }
+                break;
+            case 'C':
+                cache_path = optarg;
+                break;
+            case 'A':
+                incremental = 1;
+                break;
+            case 'X':
+                return self_test();
+            case 'L':
+                cache_slots = strtoull(optarg, NULL, 0);
+                if (cache_slots == 0) {
+                    fprintf(stderr, "Размер кэша должен быть положительным\n");
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (pattern_list_add(&patterns, optarg) != 0) {
+                    fprintf(stderr, "Ошибка выделения памяти\n");
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (pattern_list_load(&patterns, optarg) != 0) {
+                    return 1;
+                }
+                break;
+            case 'j':
+                thread_count = atoi(optarg);
+                if (thread_count <= 0) {
+                    fprintf(stderr, "Число потоков должно быть положительным\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (argc - optind < 2) {
         fprintf(stderr, "Использование:\n"
-                "  %s файл1 [файл2...] xorN\n"
-                "  %s файл1 [файл2...] mask <hex-маска>\n"
-                "  %s файл1 [файл2...] copyN\n"
-                "  %s файл1 [файл2...] find \"строка\"\n", 
-                argv[0], argv[0], argv[0], argv[0]);
+                "  %s [-j потоки] [--cache файл-кэша --incremental] файл1 [файл2...] xorN (N от 2 до 20)\n"
+                "  %s [-j потоки] [--count | --offsets[=text|bin]] [--width 8|16|32|64]\n"
+                "     [--endian little|big|host] [--start смещение] [--stride шаг] файл1 [файл2...] mask <hex-маска>\n"
+                "  %s [--fanout] файл1 [файл2...] copyN\n"
+                "  %s файл1 [файл2...] find \"строка\"\n"
+                "  %s [-e строка]... [-f файл-шаблонов] файл1 [файл2...] find\n"
+                "  %s --all [-n] | --count ... find\n"
+                "Общие опции: [--io mmap|sync|uring] [--qd глубина-очереди]\n"
+                "             [--cache файл-кэша] [--cache-slots число-записей]\n"
+                "  %s --self-test\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
     char *operation = NULL;
     char *operation_arg = NULL;
-    int first_file_index = 1;
-    int last_file_index;
+    int first_file_index = optind;
+    int last_file_index = argc - 1;
 
     if (strncmp(argv[argc-1], "xor", 3) == 0 || 
         strncmp(argv[argc-1], "copy", 4) == 0) {
@@ -265,6 +3393,10 @@ int main(int argc, char **argv) {
         operation_arg = argv[argc-1];
         last_file_index = argc - 3;
     }
+    else if (strcmp(argv[argc-1], "find") == 0 && patterns.count > 0) {
+        operation = argv[argc-1];
+        last_file_index = argc - 2;
+    }
     else {
         operation = argv[argc-1];
     }
@@ -274,20 +3406,23 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    Operation op = {0};
+    int jobs_per_file = 1;
+    Aho_corasick ac = {0};
+
     if (strncmp(operation, "xor", 3) == 0) {
         int N = atoi(operation + 3);
-        if (N < 2 || N > 6) {
-            fprintf(stderr, "N должно быть от 2 до 6 (получено %d)\n", N);
+        if (N < 2 || N > XOR_MAX_N) {
+            fprintf(stderr, "N должно быть от 2 до %d (получено %d)\n", XOR_MAX_N, N);
             return 1;
         }
-
-        for (int i = first_file_index; i <= last_file_index; i++) {
-            if (!file_exists(argv[i])) {
-                fprintf(stderr, "Файл %s не существует\n", argv[i]);
-                continue;
-            }
-            xor_operation(argv[i], N);
+        if (incremental && !cache_path) {
+            fprintf(stderr, "Для --incremental необходимо указать --cache\n");
+            return 1;
         }
+        op.type = OP_XOR;
+        op.N = N;
+        op.incremental = incremental;
     }
     else if (strcmp(operation, "mask") == 0) {
         if (!operation_arg) {
@@ -296,19 +3431,28 @@ int main(int argc, char **argv) {
         }
 
         char *endptr;
-        uint32_t mask_value = strtoul(operation_arg, &endptr, 16);
-        if (*endptr != '\0') {
+        errno = 0;
+        uint64_t mask_value = strtoull(operation_arg, &endptr, 16);
+        if (*endptr != '\0' || errno == ERANGE) {
             fprintf(stderr, "Неверный формат маски. Используйте hex, например ABCD\n");
             return 1;
         }
 
-        for (int i = first_file_index; i <= last_file_index; i++) {
-            if (!file_exists(argv[i])) {
-                fprintf(stderr, "Файл %s не существует\n", argv[i]);
-                continue;
-            }
-            mask_operation(argv[i], mask_value);
+        int word_bytes = 1 << mask_options.width;
+        if (word_bytes < 8 && mask_value >> (word_bytes * 8) != 0) {
+            fprintf(stderr, "Маска не помещается в слово из %d бит\n", word_bytes * 8);
+            return 1;
+        }
+        if (mask_options.stride == 0) {
+            mask_options.stride = word_bytes;
         }
+        if (mask_options.stride < (uint64_t)word_bytes) {
+            fprintf(stderr, "Шаг записей не может быть меньше размера слова\n");
+            return 1;
+        }
+        op.type = OP_MASK;
+        op.mask = mask_value;
+        op.mask_options = &mask_options;
     }
 
     else if (strncmp(operation, "copy", 4) == 0) {
@@ -317,86 +3461,111 @@ int main(int argc, char **argv) {
             fprintf(stderr, "N должно быть положительным числом\n");
             return 1;
         }
-
-        int status;
-        int active_processes = 0;
-    
-        for (int i = first_file_index; i <= last_file_index; i++) {
-            if (!file_exists(argv[i])) {
-                fprintf(stderr, "Файл %s не существует\n", argv[i]);
-                continue;
-            }
-    
-            for (int copy_num = 1; copy_num <= N; copy_num++) {
-                if (active_processes >= MAX_PROCESSES) {
-                    if (waitpid(-1, &status, 0) > 0) {
-                        active_processes--;
-                    }
-                }
-    
-                pid_t pid = fork();
-                if (pid == 0) {
-                    char new_name[PATH_MAX];
-                    snprintf(new_name, sizeof(new_name), "%s_%d", argv[i], copy_num);
-                    copy_file(argv[i], new_name);
-                    exit(0); 
-                } 
-                else if (pid > 0) {
-                    active_processes++;
-                } 
-                else {
-                    fprintf(stderr, "Ошибка создания процесса для копирования\n");
-                }
-            }
-        }
-    
-        while (active_processes > 0) {
-            if (waitpid(-1, &status, 0) > 0) {
-                active_processes--;
-            }
-        }
+        op.type = OP_COPY;
+        op.N = N;
+        op.fanout = fanout;
+        jobs_per_file = fanout ? 1 : N;
     }
 
     else if (strcmp(operation, "find") == 0) {
-        if (!operation_arg) {
+        if (operation_arg && patterns.count > 0 &&
+            pattern_list_add(&patterns, operation_arg) != 0) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            return 1;
+        }
+        if (!operation_arg && patterns.count == 0) {
             fprintf(stderr, "Для find необходимо указать строку поиска\n");
             return 1;
         }
-        
-        int active_processes = 0;
-        int status;
-        
-        for (int i = first_file_index; i <= last_file_index; i++) {
-            if (!file_exists(argv[i])) {
-                fprintf(stderr, "Файл %s не существует\n", argv[i]);
-                continue;
+        if (!operation_arg && patterns.count == 1) {
+            operation_arg = patterns.raw[0];
+        }
+        if (find_options.mode != FIND_FIRST) {
+            if (patterns.count == 0 && pattern_list_add(&patterns, operation_arg) != 0) {
+                fprintf(stderr, "Ошибка выделения памяти\n");
+                return 1;
             }
-        
-            while (active_processes >= MAX_PROCESSES) {
-                if (waitpid(-1, &status, 0) > 0) {
-                    active_processes--;
+            for (int i = 0; i < patterns.count; i++) {
+                if (patterns.lens[i] == 0) {
+                    fprintf(stderr, "Для --all и --count строка поиска не может быть пустой\n");
+                    return 1;
                 }
             }
-        
-            pid_t pid = fork();
-            if (pid == 0) {
-                find_in_file(argv[i], operation_arg);
-                exit(0); 
-            } 
-            else if (pid > 0) {
-                active_processes++;
-            } 
-            else {
-                fprintf(stderr, "Ошибка создания процесса для поиска\n");
-                continue;
-            }
         }
-        
-        while (active_processes > 0) {
-            if (waitpid(-1, &status, 0) > 0) {
-                active_processes--;
-            }
+
+        if (patterns.count > 1 && aho_corasick_build(&ac, &patterns) != 0) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            return 1;
         }
+        op.type = OP_FIND;
+        op.search_str = operation_arg;
+        op.patterns = &patterns;
+        op.ac = &ac;
+        op.find_options = &find_options;
     }
-    return 0;
-}
\ No newline at end of file
+    else {
+        fprintf(stderr, "Неизвестная операция %s\n", operation);
+        return 1;
+    }
+
+    if (cache_path && op.type != OP_COPY) {
+        op.cache = result_cache_open(cache_path, cache_slots);
+        if (!op.cache) {
+            fprintf(stderr, "Ошибка открытия кэша %s\n", cache_path);
+            return 1;
+        }
+        op.cache_tag = operation_cache_tag(&op);
+    }
+
+    Thread_pool pool;
+    if (thread_pool_init(&pool, thread_count) != 0) {
+        fprintf(stderr, "Ошибка создания потоков\n");
+        return 1;
+    }
+    op.pool = &pool;
+
+    size_t job_count = (size_t)(last_file_index - first_file_index + 1) * jobs_per_file;
+    Job *jobs = calloc(job_count, sizeof(Job));
+    Out_buffer **buffers = malloc(job_count * sizeof(Out_buffer *));
+    if (!jobs || !buffers) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        return 1;
+    }
+
+    Output_order order;
+    output_order_init(&order, buffers, job_count);
+    Wait_group wg;
+    wait_group_init(&wg, job_count);
+
+    for (size_t k = 0; k < job_count; k++) {
+        Job *job = &jobs[k];
+        job->op = &op;
+        job->filename = argv[first_file_index + k / jobs_per_file];
+        job->copy_num = k % jobs_per_file + 1;
+        job->order = &order;
+        job->wg = &wg;
+        out_init(&job->out, STDOUT_FILENO, &order, k);
+        buffers[k] = &job->out;
+    }
+    for (size_t k = 0; k < job_count; k++) {
+        if (thread_pool_submit(&pool, run_job, &jobs[k]) != 0) {
+            run_job(&jobs[k]);
+        }
+    }
+
+    wait_group_wait(&wg);
+    thread_pool_destroy(&pool);
+
+    int exit_status = 0;
+    for (size_t k = 0; k < job_count; k++) {
+        if (jobs[k].status != 0) exit_status = 1;
+    }
+
+    output_order_destroy(&order);
+    free(buffers);
+    free(jobs);
+    result_cache_close(op.cache);
+    aho_corasick_free(&ac);
+    pattern_list_free(&patterns);
+    return exit_status;
+}
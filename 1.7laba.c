@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
@@ -6,8 +7,216 @@
 #include <string.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/mman.h>
 
 #define PATH_MAX 4096
+#define DIR_BUFFER_DEFAULT (1 << 20)
+#define DIR_BUFFER_MIN (32 << 10)
+#define TEXT_SPILL_LIMIT (16 << 20)
+#define OUT_WRITER_SIZE (1 << 20)
+#define SORT_MEMORY_DEFAULT (64 << 20)
+#define SNAPSHOT_MAGIC "1.7SNAP"
+#define SNAPSHOT_VERSION 1
+#define STATS_TYPES 8
+#define STATS_BUCKETS 33
+#define STATS_DEPTHS 64
+#define STATS_TOP_DEFAULT 10
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    FILE *spill;
+} Text_buffer;
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t len;
+    size_t capacity;
+} Out_writer;
+
+static void text_spill(Text_buffer *buf) {
+    if (!buf->spill) {
+        buf->spill = tmpfile();
+        if (!buf->spill) {
+            fprintf(stderr, "Ошибка создания временного файла\n");
+            exit(1);
+        }
+    }
+    if (fwrite(buf->data, 1, buf->len, buf->spill) != buf->len) {
+        fprintf(stderr, "Ошибка записи во временный файл\n");
+        exit(1);
+    }
+    buf->len = 0;
+}
+
+static void text_reserve(Text_buffer *buf, size_t n) {
+    if (buf->len > 0 && buf->len + n > TEXT_SPILL_LIMIT) {
+        text_spill(buf);
+    }
+    if (buf->len + n > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 256;
+        while (capacity < buf->len + n) capacity *= 2;
+        char *data = realloc(buf->data, capacity);
+        if (!data) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+}
+
+void text_bytes(Text_buffer *buf, const void *data, size_t len) {
+    text_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+void text_str(Text_buffer *buf, const char *str) {
+    text_bytes(buf, str, strlen(str));
+}
+
+void text_char(Text_buffer *buf, char c) {
+    text_reserve(buf, 1);
+    buf->data[buf->len++] = c;
+}
+
+size_t text_u64(Text_buffer *buf, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    text_reserve(buf, count);
+    for (size_t i = count; i > 0; i--) {
+        buf->data[buf->len++] = digits[i - 1];
+    }
+    return count;
+}
+
+void text_pad(Text_buffer *buf, size_t written, size_t width) {
+    if (written >= width) return;
+    text_reserve(buf, width - written);
+    memset(buf->data + buf->len, ' ', width - written);
+    buf->len += width - written;
+}
+
+static size_t utf8_sequence_len(const unsigned char *s, size_t len) {
+    size_t n;
+    unsigned char low = 0x80, high = 0xBF;
+    if (s[0] < 0x80) return 1;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        n = 2;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        n = 3;
+        if (s[0] == 0xE0) low = 0xA0;
+        if (s[0] == 0xED) high = 0x9F;
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        n = 4;
+        if (s[0] == 0xF0) low = 0x90;
+        if (s[0] == 0xF4) high = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (len < n || s[1] < low || s[1] > high) return 0;
+    for (size_t i = 2; i < n; i++) {
+        if (s[i] < 0x80 || s[i] > 0xBF) return 0;
+    }
+    return n;
+}
+
+void text_json_string(Text_buffer *buf, const char *str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    text_char(buf, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = str[i];
+        size_t n;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', c };
+            text_bytes(buf, escaped, 2);
+        } else if (c < 0x20 || (n = utf8_sequence_len((const unsigned char *)str + i, len - i)) == 0) {
+            char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+            text_bytes(buf, escaped, 6);
+        } else {
+            text_bytes(buf, str + i, n);
+            i += n - 1;
+        }
+    }
+    text_char(buf, '"');
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+void writer_flush(Out_writer *writer) {
+    if (writer->len > 0 && write_all(writer->fd, writer->data, writer->len) != 0) {
+        fprintf(stderr, "Ошибка записи вывода\n");
+        exit(1);
+    }
+    writer->len = 0;
+}
+
+void writer_write(Out_writer *writer, const char *data, size_t len) {
+    if (len == 0) return;
+    if (writer->len + len > writer->capacity) {
+        writer_flush(writer);
+    }
+    if (len >= writer->capacity) {
+        if (write_all(writer->fd, data, len) != 0) {
+            fprintf(stderr, "Ошибка записи вывода\n");
+            exit(1);
+        }
+        return;
+    }
+    memcpy(writer->data + writer->len, data, len);
+    writer->len += len;
+}
+
+void writer_copy_spill(Out_writer *writer, FILE *spill) {
+    rewind(spill);
+    size_t n;
+    do {
+        if (writer->len == writer->capacity) writer_flush(writer);
+        n = fread(writer->data + writer->len, 1, writer->capacity - writer->len, spill);
+        writer->len += n;
+    } while (n > 0);
+    fclose(spill);
+}
+
+mode_t dtype_to_mode(unsigned char type) {
+    switch (type) {
+        case DT_REG: return S_IFREG;
+        case DT_DIR: return S_IFDIR;
+        case DT_CHR: return S_IFCHR;
+        case DT_BLK: return S_IFBLK;
+        case DT_FIFO: return S_IFIFO;
+        case DT_SOCK: return S_IFSOCK;
+        default: return 0;
+    }
+}
 
 const char* get_file_type(mode_t mode) {
     if (S_ISREG(mode)) return "файл";
@@ -19,47 +228,1558 @@ const char* get_file_type(mode_t mode) {
     return "неизвестный тип";
 }
 
-void my_ls(const char *dirpath) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat file_stat;
-    char fullpath[PATH_MAX];
+const char* get_type_code(mode_t mode) {
+    if (S_ISREG(mode)) return "file";
+    if (S_ISDIR(mode)) return "dir";
+    if (S_ISCHR(mode)) return "chr";
+    if (S_ISBLK(mode)) return "blk";
+    if (S_ISFIFO(mode)) return "fifo";
+    if (S_ISLNK(mode)) return "link";
+    if (S_ISSOCK(mode)) return "sock";
+    return "unknown";
+}
+
+enum { FORMAT_TEXT, FORMAT_NUL, FORMAT_JSON, FORMAT_BIN };
+enum { SORT_NONE, SORT_NAME, SORT_INODE };
+
+typedef struct {
+    uint64_t ino;
+    uint32_t mode;
+    uint16_t name_len;
+    uint8_t descend;
+    char name[];
+} Sort_record;
+
+typedef struct {
+    int key;
+    size_t limit;
+    char *arena;
+    size_t arena_len;
+    size_t arena_capacity;
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+    FILE **runs;
+    size_t run_count;
+    size_t run_capacity;
+} Sorter;
+
+typedef struct {
+    FILE *file;
+    int valid;
+    union {
+        Sort_record record;
+        char storage[sizeof(Sort_record) + 256];
+    } u;
+} Sort_run;
+
+static int sort_compare(const Sort_record *a, const Sort_record *b, int key) {
+    if (key == SORT_INODE && a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    size_t len = a->name_len < b->name_len ? a->name_len : b->name_len;
+    int result = memcmp(a->name, b->name, len);
+    if (result != 0) return result;
+    return (a->name_len > b->name_len) - (a->name_len < b->name_len);
+}
+
+static int sort_compare_offsets(const void *a, const void *b, void *arg) {
+    Sorter *sorter = (Sorter *)arg;
+    return sort_compare((const Sort_record *)(sorter->arena + *(const size_t *)a),
+                        (const Sort_record *)(sorter->arena + *(const size_t *)b), sorter->key);
+}
+
+static void sorter_spill(Sorter *sorter) {
+    qsort_r(sorter->offsets, sorter->count, sizeof(size_t), sort_compare_offsets, sorter);
+
+    FILE *run = tmpfile();
+    if (!run) {
+        fprintf(stderr, "Ошибка создания временного файла\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < sorter->count; i++) {
+        const Sort_record *record = (const Sort_record *)(sorter->arena + sorter->offsets[i]);
+        size_t size = offsetof(Sort_record, name) + record->name_len;
+        if (fwrite(record, 1, size, run) != size) {
+            fprintf(stderr, "Ошибка записи во временный файл\n");
+            exit(1);
+        }
+    }
+
+    if (sorter->run_count == sorter->run_capacity) {
+        size_t capacity = sorter->run_capacity ? sorter->run_capacity * 2 : 8;
+        FILE **runs = realloc(sorter->runs, capacity * sizeof(FILE *));
+        if (!runs) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        sorter->runs = runs;
+        sorter->run_capacity = capacity;
+    }
+    sorter->runs[sorter->run_count++] = run;
+    sorter->count = 0;
+    sorter->arena_len = 0;
+}
+
+void sorter_add(Sorter *sorter, uint64_t ino, mode_t mode, const char *name, size_t name_len, int descend) {
+    size_t size = (offsetof(Sort_record, name) + name_len + 1 + 7) & ~(size_t)7;
+    if (sorter->count > 0 && sorter->arena_len + size + sorter->count * sizeof(size_t) > sorter->limit) {
+        sorter_spill(sorter);
+    }
+
+    if (sorter->arena_len + size > sorter->arena_capacity) {
+        size_t capacity = sorter->arena_capacity ? sorter->arena_capacity * 2 : 64 << 10;
+        while (capacity < sorter->arena_len + size) capacity *= 2;
+        char *arena = realloc(sorter->arena, capacity);
+        if (!arena) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        sorter->arena = arena;
+        sorter->arena_capacity = capacity;
+    }
+    if (sorter->count == sorter->capacity) {
+        size_t capacity = sorter->capacity ? sorter->capacity * 2 : 1024;
+        size_t *offsets = realloc(sorter->offsets, capacity * sizeof(size_t));
+        if (!offsets) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        sorter->offsets = offsets;
+        sorter->capacity = capacity;
+    }
 
-    dir = opendir(dirpath);
-    if (dir == NULL) {
-        fprintf(stderr, "Ошибка открытия каталога '%s'\n", dirpath);
+    Sort_record *record = (Sort_record *)(sorter->arena + sorter->arena_len);
+    record->ino = ino;
+    record->mode = mode;
+    record->name_len = name_len;
+    record->descend = descend;
+    memcpy(record->name, name, name_len);
+    record->name[name_len] = '\0';
+    sorter->offsets[sorter->count++] = sorter->arena_len;
+    sorter->arena_len += size;
+}
+
+static void sort_run_next(Sort_run *run) {
+    Sort_record *record = &run->u.record;
+    run->valid = fread(record, offsetof(Sort_record, name), 1, run->file) == 1 &&
+                 fread(record->name, 1, record->name_len, run->file) == record->name_len;
+    if (run->valid) record->name[record->name_len] = '\0';
+}
+
+typedef void (*Sort_visit)(void *ctx, const Sort_record *record);
+
+void sorter_finish(Sorter *sorter, Sort_visit visit, void *ctx) {
+    if (sorter->run_count == 0) {
+        qsort_r(sorter->offsets, sorter->count, sizeof(size_t), sort_compare_offsets, sorter);
+        for (size_t i = 0; i < sorter->count; i++) {
+            visit(ctx, (const Sort_record *)(sorter->arena + sorter->offsets[i]));
+        }
+        sorter->count = 0;
+        sorter->arena_len = 0;
         return;
     }
 
-    while ((entry = readdir(dir)) != NULL) {
+    if (sorter->count > 0) {
+        sorter_spill(sorter);
+    }
+
+    Sort_run *runs = calloc(sorter->run_count, sizeof(Sort_run));
+    if (!runs) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < sorter->run_count; i++) {
+        runs[i].file = sorter->runs[i];
+        rewind(runs[i].file);
+        sort_run_next(&runs[i]);
+    }
+
+    while (1) {
+        Sort_run *best = NULL;
+        for (size_t i = 0; i < sorter->run_count; i++) {
+            if (runs[i].valid && (!best || sort_compare(&runs[i].u.record, &best->u.record, sorter->key) < 0)) {
+                best = &runs[i];
+            }
+        }
+        if (!best) break;
+        visit(ctx, &best->u.record);
+        sort_run_next(best);
+    }
+
+    for (size_t i = 0; i < sorter->run_count; i++) {
+        fclose(sorter->runs[i]);
+    }
+    free(runs);
+    sorter->run_count = 0;
+}
+
+void sorter_free(Sorter *sorter) {
+    free(sorter->arena);
+    free(sorter->offsets);
+    free(sorter->runs);
+}
+
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} Linux_dirent64;
+
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t size;
+    size_t pos;
+    size_t len;
+    unsigned long calls;
+} Dir_reader;
+
+void dir_reader_init(Dir_reader *reader, int fd, char *buffer, size_t size) {
+    reader->fd = fd;
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->calls = 0;
+}
+
+int dir_reader_next(Dir_reader *reader, Linux_dirent64 **entry) {
+    if (reader->pos >= reader->len) {
+        long bytes = syscall(SYS_getdents64, reader->fd, reader->buffer, reader->size);
+        reader->calls++;
+        if (bytes <= 0) {
+            return bytes == 0 ? 0 : -1;
+        }
+        reader->pos = 0;
+        reader->len = bytes;
+    }
+    *entry = (Linux_dirent64 *)(reader->buffer + reader->pos);
+    reader->pos += (*entry)->d_reclen;
+    return 1;
+}
+
+typedef struct {
+    uint64_t ino;
+    int64_t mtime_ns;
+    uint32_t name_offset;
+    uint16_t name_len;
+    uint8_t type;
+    uint8_t reserved;
+} Snap_entry;
+
+typedef struct {
+    Snap_entry *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+} Snap_list;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t dir_count;
+    uint64_t dirs_offset;
+    uint64_t paths_offset;
+} Snap_header;
+
+typedef struct {
+    uint64_t path_offset;
+    uint32_t path_len;
+    uint32_t entry_count;
+    int64_t mtime_ns;
+    uint64_t ino;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+} Snap_dir;
+
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    size_t size;
+    const Snap_header *header;
+    const Snap_dir *dirs;
+} Snapshot;
+
+typedef struct {
+    FILE *file;
+    char *path;
+    char *tmp_path;
+    uint64_t offset;
+    Snap_dir *dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    char *paths;
+    size_t paths_len;
+    size_t paths_capacity;
+} Snapshot_writer;
+
+static void *grow_array(void *data, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return data;
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *grown = realloc(data, new_capacity * item_size);
+    if (!grown) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+static int name_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int result = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (result != 0) return result;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+void snap_list_add(Snap_list *list, uint64_t ino, int64_t mtime_ns, uint8_t type, const char *name, size_t name_len) {
+    list->entries = grow_array(list->entries, &list->capacity, list->count + 1, sizeof(Snap_entry));
+    list->names = grow_array(list->names, &list->names_capacity, list->names_len + name_len + 1, 1);
+
+    Snap_entry *entry = &list->entries[list->count++];
+    entry->ino = ino;
+    entry->mtime_ns = mtime_ns;
+    entry->name_offset = list->names_len;
+    entry->name_len = name_len;
+    entry->type = type;
+    entry->reserved = 0;
+    memcpy(list->names + list->names_len, name, name_len + 1);
+    list->names_len += name_len + 1;
+}
+
+static int snap_entry_compare(const void *a, const void *b, void *arg) {
+    const char *names = (const char *)arg;
+    const Snap_entry *x = (const Snap_entry *)a;
+    const Snap_entry *y = (const Snap_entry *)b;
+    return name_compare(names + x->name_offset, x->name_len, names + y->name_offset, y->name_len);
+}
+
+void snap_list_sort(Snap_list *list) {
+    qsort_r(list->entries, list->count, sizeof(Snap_entry), snap_entry_compare, list->names);
+}
+
+void snap_list_free(Snap_list *list) {
+    free(list->entries);
+    free(list->names);
+}
+
+Snapshot *snapshot_open(const char *path) {
+    Snapshot *snapshot = calloc(1, sizeof(Snapshot));
+    if (!snapshot) return NULL;
+
+    struct stat st;
+    snapshot->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (snapshot->fd == -1 || fstat(snapshot->fd, &st) == -1 || (size_t)st.st_size < sizeof(Snap_header)) {
+        goto fail;
+    }
+    snapshot->size = st.st_size;
+    void *map = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, snapshot->fd, 0);
+    if (map == MAP_FAILED) goto fail;
+    snapshot->data = map;
+    snapshot->header = (const Snap_header *)map;
+
+    const Snap_header *header = snapshot->header;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->dirs_offset > snapshot->size ||
+        header->dir_count > (snapshot->size - header->dirs_offset) / sizeof(Snap_dir) ||
+        header->dirs_offset % _Alignof(Snap_dir) != 0 || header->paths_offset > snapshot->size) {
+        munmap(map, snapshot->size);
+        goto fail;
+    }
+    snapshot->dirs = (const Snap_dir *)(snapshot->data + header->dirs_offset);
+    return snapshot;
+
+fail:
+    if (snapshot->fd != -1) close(snapshot->fd);
+    free(snapshot);
+    return NULL;
+}
+
+void snapshot_close(Snapshot *snapshot) {
+    if (!snapshot) return;
+    munmap((void *)snapshot->data, snapshot->size);
+    close(snapshot->fd);
+    free(snapshot);
+}
+
+static int snapshot_dir_valid(const Snapshot *snapshot, const Snap_dir *dir) {
+    if (dir->entries_offset > snapshot->size || dir->entries_offset % _Alignof(Snap_entry) != 0 ||
+        dir->entry_count > (snapshot->size - dir->entries_offset) / sizeof(Snap_entry) ||
+        dir->names_offset > snapshot->size) {
+        return 0;
+    }
+    const Snap_entry *entries = (const Snap_entry *)(snapshot->data + dir->entries_offset);
+    const char *names = (const char *)snapshot->data + dir->names_offset;
+    size_t names_size = snapshot->size - dir->names_offset;
+    for (uint32_t i = 0; i < dir->entry_count; i++) {
+        const Snap_entry *entry = &entries[i];
+        if (entry->name_len == 0 || entry->name_offset >= names_size ||
+            entry->name_len >= names_size - entry->name_offset) {
+            return 0;
+        }
+        const char *name = names + entry->name_offset;
+        if (name[entry->name_len] != '\0' || memchr(name, '/', entry->name_len) ||
+            memchr(name, '\0', entry->name_len)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void path_normalize(char *path) {
+    char *out = path;
+    const char *in = path;
+    if (*in == '/') *out++ = '/';
+    while (*in) {
+        while (*in == '/') in++;
+        const char *segment = in;
+        while (*in && *in != '/') in++;
+        size_t len = in - segment;
+        if (len == 0 || (len == 1 && segment[0] == '.')) continue;
+        if (out > path && out[-1] != '/') *out++ = '/';
+        memmove(out, segment, len);
+        out += len;
+    }
+    if (out == path) *out++ = '.';
+    *out = '\0';
+}
+
+const Snap_dir *snapshot_find(const Snapshot *snapshot, const char *path) {
+    char *key = strdup(path);
+    if (!key) return NULL;
+    path_normalize(key);
+    size_t key_len = strlen(key);
+    const Snap_dir *found = NULL;
+    const char *paths = (const char *)snapshot->data + snapshot->header->paths_offset;
+    size_t paths_size = snapshot->size - snapshot->header->paths_offset;
+    size_t low = 0, high = snapshot->header->dir_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const Snap_dir *dir = &snapshot->dirs[mid];
+        if (dir->path_offset > paths_size || dir->path_len > paths_size - dir->path_offset) break;
+        int result = name_compare(paths + dir->path_offset, dir->path_len, key, key_len);
+        if (result == 0) {
+            if (snapshot_dir_valid(snapshot, dir)) found = dir;
+            break;
+        }
+        if (result < 0) low = mid + 1;
+        else high = mid;
+    }
+    free(key);
+    return found;
+}
+
+static void snapshot_write(Snapshot_writer *writer, const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, writer->file) != len) {
+        fprintf(stderr, "Ошибка записи снимка '%s'\n", writer->tmp_path);
+        exit(1);
+    }
+    writer->offset += len;
+}
+
+static void snapshot_align(Snapshot_writer *writer) {
+    static const char zeros[8] = {0};
+    snapshot_write(writer, zeros, (8 - writer->offset % 8) % 8);
+}
+
+Snapshot_writer *snapshot_writer_open(const char *path) {
+    Snapshot_writer *writer = calloc(1, sizeof(Snapshot_writer));
+    if (!writer) return NULL;
+    writer->path = strdup(path);
+    writer->tmp_path = malloc(strlen(path) + 5);
+    if (!writer->path || !writer->tmp_path) {
+        free(writer->path);
+        free(writer->tmp_path);
+        free(writer);
+        return NULL;
+    }
+    sprintf(writer->tmp_path, "%s.tmp", path);
+
+    writer->file = fopen(writer->tmp_path, "wb");
+    if (!writer->file) {
+        free(writer->path);
+        free(writer->tmp_path);
+        free(writer);
+        return NULL;
+    }
+    Snap_header header = {0};
+    snapshot_write(writer, &header, sizeof(header));
+    return writer;
+}
+
+void snapshot_writer_add(Snapshot_writer *writer, const char *path, int64_t mtime_ns, uint64_t ino,
+                         const Snap_list *list) {
+    writer->dirs = grow_array(writer->dirs, &writer->dir_capacity, writer->dir_count + 1, sizeof(Snap_dir));
+    size_t path_len = strlen(path);
+    writer->paths = grow_array(writer->paths, &writer->paths_capacity, writer->paths_len + path_len + 1, 1);
+    char *key = writer->paths + writer->paths_len;
+    memcpy(key, path, path_len + 1);
+    path_normalize(key);
+    path_len = strlen(key);
+
+    Snap_dir *dir = &writer->dirs[writer->dir_count++];
+    dir->path_offset = writer->paths_len;
+    dir->path_len = path_len;
+    dir->entry_count = list->count;
+    dir->mtime_ns = mtime_ns;
+    dir->ino = ino;
+    writer->paths_len += path_len + 1;
+
+    dir->entries_offset = writer->offset;
+    snapshot_write(writer, list->entries, list->count * sizeof(Snap_entry));
+    dir->names_offset = writer->offset;
+    snapshot_write(writer, list->names, list->names_len);
+    snapshot_align(writer);
+}
+
+static int snap_dir_compare(const void *a, const void *b, void *arg) {
+    const char *paths = (const char *)arg;
+    const Snap_dir *x = (const Snap_dir *)a;
+    const Snap_dir *y = (const Snap_dir *)b;
+    return name_compare(paths + x->path_offset, x->path_len, paths + y->path_offset, y->path_len);
+}
+
+int snapshot_writer_finish(Snapshot_writer *writer) {
+    qsort_r(writer->dirs, writer->dir_count, sizeof(Snap_dir), snap_dir_compare, writer->paths);
+
+    Snap_header header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.dir_count = writer->dir_count;
+    header.dirs_offset = writer->offset;
+    snapshot_write(writer, writer->dirs, writer->dir_count * sizeof(Snap_dir));
+    header.paths_offset = writer->offset;
+    snapshot_write(writer, writer->paths, writer->paths_len);
+
+    int status = fseek(writer->file, 0, SEEK_SET) == 0 &&
+                 fwrite(&header, sizeof(header), 1, writer->file) == 1 ? 0 : -1;
+    if (fclose(writer->file) != 0) status = -1;
+    if (status == 0 && rename(writer->tmp_path, writer->path) != 0) status = -1;
+    if (status != 0) {
+        fprintf(stderr, "Ошибка записи снимка '%s'\n", writer->path);
+        unlink(writer->tmp_path);
+    }
+
+    free(writer->dirs);
+    free(writer->paths);
+    free(writer->path);
+    free(writer->tmp_path);
+    free(writer);
+    return status;
+}
+
+typedef struct {
+    uint64_t size;
+    char *path;
+} Top_file;
+
+typedef struct {
+    uint64_t count[STATS_TYPES];
+    uint64_t bytes[STATS_TYPES];
+    uint64_t dir_histogram[STATS_BUCKETS];
+    uint64_t depth_entries[STATS_DEPTHS];
+    uint64_t dirs;
+    Top_file *top;
+    size_t top_count;
+    size_t top_limit;
+} Stats;
+
+static const mode_t stats_modes[STATS_TYPES] = {
+    S_IFREG, S_IFDIR, S_IFCHR, S_IFBLK, S_IFIFO, S_IFLNK, S_IFSOCK, 0
+};
+
+static int stats_type_index(mode_t mode) {
+    for (int i = 0; i < STATS_TYPES - 1; i++) {
+        if ((mode & S_IFMT) == stats_modes[i]) return i;
+    }
+    return STATS_TYPES - 1;
+}
+
+static void top_sift_down(Top_file *heap, size_t count, size_t i) {
+    while (1) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < count && heap[left].size < heap[smallest].size) smallest = left;
+        if (right < count && heap[right].size < heap[smallest].size) smallest = right;
+        if (smallest == i) return;
+        Top_file tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void top_sift_up(Top_file *heap, size_t i) {
+    while (i > 0 && heap[(i - 1) / 2].size > heap[i].size) {
+        Top_file tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static int top_accepts(const Stats *stats, uint64_t size) {
+    if (stats->top_limit == 0) return 0;
+    return stats->top_count < stats->top_limit || size > stats->top[0].size;
+}
+
+static void top_insert(Stats *stats, uint64_t size, char *path) {
+    if (!top_accepts(stats, size)) {
+        free(path);
+        return;
+    }
+    if (stats->top_count < stats->top_limit) {
+        stats->top[stats->top_count] = (Top_file){ size, path };
+        top_sift_up(stats->top, stats->top_count++);
+        return;
+    }
+    free(stats->top[0].path);
+    stats->top[0] = (Top_file){ size, path };
+    top_sift_down(stats->top, stats->top_count, 0);
+}
+
+void stats_init(Stats *stats, size_t top_limit) {
+    memset(stats, 0, sizeof(*stats));
+    stats->top_limit = top_limit;
+    if (top_limit > 0) {
+        stats->top = malloc(top_limit * sizeof(Top_file));
+        if (!stats->top) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+    }
+}
+
+void stats_free(Stats *stats) {
+    for (size_t i = 0; i < stats->top_count; i++) {
+        free(stats->top[i].path);
+    }
+    free(stats->top);
+    stats->top = NULL;
+    stats->top_count = 0;
+}
+
+static int stats_bucket(uint64_t entries) {
+    return entries == 0 ? 0 : 64 - __builtin_clzll(entries);
+}
+
+void stats_directory(Stats *stats, int depth, uint64_t entries) {
+    stats->dirs++;
+    stats->dir_histogram[stats_bucket(entries)]++;
+    stats->depth_entries[depth < STATS_DEPTHS ? depth : STATS_DEPTHS - 1] += entries;
+}
+
+void stats_entry(Stats *stats, const char *dir_path, const char *name, mode_t mode, uint64_t size) {
+    int type = stats_type_index(mode);
+    stats->count[type]++;
+    stats->bytes[type] += size;
+    if (!S_ISREG(mode) || !top_accepts(stats, size)) return;
+
+    char *path = malloc(strlen(dir_path) + strlen(name) + 2);
+    if (!path) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        exit(1);
+    }
+    sprintf(path, "%s/%s", dir_path, name);
+    top_insert(stats, size, path);
+}
+
+void stats_merge(Stats *into, Stats *from) {
+    for (int i = 0; i < STATS_TYPES; i++) {
+        into->count[i] += from->count[i];
+        into->bytes[i] += from->bytes[i];
+    }
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        into->dir_histogram[i] += from->dir_histogram[i];
+    }
+    for (int i = 0; i < STATS_DEPTHS; i++) {
+        into->depth_entries[i] += from->depth_entries[i];
+    }
+    into->dirs += from->dirs;
+    for (size_t i = 0; i < from->top_count; i++) {
+        top_insert(into, from->top[i].size, from->top[i].path);
+    }
+    from->top_count = 0;
+    stats_free(from);
+}
+
+static int top_compare(const void *a, const void *b) {
+    const Top_file *x = (const Top_file *)a;
+    const Top_file *y = (const Top_file *)b;
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    return strcmp(x->path, y->path);
+}
+
+static void stats_print_json_string(const char *str) {
+    Text_buffer buf = {0};
+    text_json_string(&buf, str, strlen(str));
+    fwrite(buf.data, 1, buf.len, stdout);
+    free(buf.data);
+}
+
+void stats_print(Stats *stats, int format) {
+    qsort(stats->top, stats->top_count, sizeof(Top_file), top_compare);
+    int max_depth = STATS_DEPTHS - 1;
+    while (max_depth > 0 && stats->depth_entries[max_depth] == 0) max_depth--;
+    int max_bucket = STATS_BUCKETS - 1;
+    while (max_bucket > 0 && stats->dir_histogram[max_bucket] == 0) max_bucket--;
+
+    if (format == FORMAT_JSON) {
+        printf("{\"types\":{");
+        for (int i = 0; i < STATS_TYPES; i++) {
+            printf("%s\"%s\":{\"count\":%llu,\"bytes\":%llu}", i ? "," : "", get_type_code(stats_modes[i]),
+                   (unsigned long long)stats->count[i], (unsigned long long)stats->bytes[i]);
+        }
+        printf("},\"dirs\":%llu,\"top\":[", (unsigned long long)stats->dirs);
+        for (size_t i = 0; i < stats->top_count; i++) {
+            printf("%s{\"size\":%llu,\"path\":", i ? "," : "", (unsigned long long)stats->top[i].size);
+            stats_print_json_string(stats->top[i].path);
+            printf("}");
+        }
+        printf("],\"entries_per_dir\":[");
+        for (int i = 0; i <= max_bucket; i++) {
+            printf("%s{\"min\":%llu,\"max\":%llu,\"dirs\":%llu}", i ? "," : "",
+                   i == 0 ? 0ULL : 1ULL << (i - 1), i == 0 ? 0ULL : (1ULL << (i - 1)) * 2 - 1,
+                   (unsigned long long)stats->dir_histogram[i]);
+        }
+        printf("],\"entries_per_depth\":[");
+        for (int i = 0; i <= max_depth; i++) {
+            printf("%s%llu", i ? "," : "", (unsigned long long)stats->depth_entries[i]);
+        }
+        printf("]}\n");
+        return;
+    }
+
+    printf("Статистика по типам:\n");
+    for (int i = 0; i < STATS_TYPES; i++) {
+        if (stats->count[i] == 0) continue;
+        printf("  %12llu записей %16llu байт  %s\n", (unsigned long long)stats->count[i],
+               (unsigned long long)stats->bytes[i], get_file_type(stats_modes[i]));
+    }
+    printf("Крупнейшие файлы:\n");
+    for (size_t i = 0; i < stats->top_count; i++) {
+        printf("  %16llu  %s\n", (unsigned long long)stats->top[i].size, stats->top[i].path);
+    }
+    printf("Записей в каталоге (каталогов всего: %llu):\n", (unsigned long long)stats->dirs);
+    for (int i = 0; i <= max_bucket; i++) {
+        if (i == 0) {
+            printf("  %10d%-11s: %llu\n", 0, "", (unsigned long long)stats->dir_histogram[i]);
+        } else {
+            printf("  %10llu-%-10llu: %llu\n", 1ULL << (i - 1), (1ULL << (i - 1)) * 2 - 1,
+                   (unsigned long long)stats->dir_histogram[i]);
+        }
+    }
+    printf("Записей по глубине:\n");
+    for (int i = 0; i <= max_depth; i++) {
+        printf("  %3d%s: %llu\n", i, i == STATS_DEPTHS - 1 ? "+" : "", (unsigned long long)stats->depth_entries[i]);
+    }
+}
+
+typedef struct Dir_node Dir_node;
+
+struct Dir_node {
+    Dir_node *parent;
+    size_t index;
+    char *path;
+    const char *name;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    int depth;
+    int listed;
+    Snap_list snap;
+    size_t pending;
+    int done;
+    Dir_node **children;
+    size_t child_count;
+    size_t child_capacity;
+    Text_buffer out;
+};
+
+enum { MODE_LIST, MODE_SNAPSHOT, MODE_DIFF, MODE_STATS };
+
+typedef struct {
+    int mode;
+    Snapshot *snapshot;
+    Snapshot_writer *snapshot_writer;
+    unsigned long dirs_skipped;
+    Stats stats;
+    int recursive;
+    int follow_links;
+    int verbose;
+    int format;
+    int sort_key;
+    size_t sort_memory;
+    Out_writer writer;
+    size_t buffer_size;
+    unsigned long entries;
+    unsigned long stats_avoided;
+    Dir_node **stack;
+    size_t stack_len;
+    size_t stack_capacity;
+    size_t active;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_cond_t idle;
+    pthread_mutex_t emit_mutex;
+    Dir_node *cursor;
+} Walker;
+
+Dir_node *dir_node_create(Dir_node *parent, const char *name) {
+    Dir_node *node = calloc(1, sizeof(Dir_node));
+    if (!node) return NULL;
+
+    if (parent) {
+        size_t parent_len = strlen(parent->path);
+        node->path = malloc(parent_len + strlen(name) + 2);
+        if (!node->path) {
+            free(node);
+            return NULL;
+        }
+        sprintf(node->path, "%s/%s", parent->path, name);
+        node->name = node->path + parent_len + 1;
+    } else {
+        node->path = strdup(name);
+        if (!node->path) {
+            free(node);
+            return NULL;
+        }
+        node->name = node->path;
+    }
+    node->parent = parent;
+    node->depth = parent ? parent->depth + 1 : 0;
+    node->fd = -1;
+    return node;
+}
+
+void dir_node_free(Dir_node *node) {
+    if (node->out.spill) fclose(node->out.spill);
+    snap_list_free(&node->snap);
+    free(node->children);
+    free(node->out.data);
+    free(node->path);
+    free(node);
+}
+
+static int dir_node_add_child(Dir_node *node, Dir_node *child) {
+    if (node->child_count == node->child_capacity) {
+        size_t capacity = node->child_capacity ? node->child_capacity * 2 : 8;
+        Dir_node **children = realloc(node->children, capacity * sizeof(Dir_node *));
+        if (!children) return -1;
+        node->children = children;
+        node->child_capacity = capacity;
+    }
+    child->index = node->child_count;
+    node->children[node->child_count++] = child;
+    return 0;
+}
+
+static int is_ancestor(const Dir_node *node, dev_t dev, ino_t ino) {
+    for (; node; node = node->parent) {
+        if (node->dev == dev && node->ino == ino) return 1;
+    }
+    return 0;
+}
+
+static void dir_node_release_fd(Dir_node *node) {
+    if (__atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(node->fd);
+    }
+}
+
+void walker_push(Walker *walker, Dir_node *node) {
+    pthread_mutex_lock(&walker->mutex);
+    if (walker->stack_len == walker->stack_capacity) {
+        size_t capacity = walker->stack_capacity ? walker->stack_capacity * 2 : 64;
+        Dir_node **stack = realloc(walker->stack, capacity * sizeof(Dir_node *));
+        if (!stack) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            exit(1);
+        }
+        walker->stack = stack;
+        walker->stack_capacity = capacity;
+    }
+    walker->stack[walker->stack_len++] = node;
+    walker->active++;
+    pthread_cond_signal(&walker->cond);
+    pthread_mutex_unlock(&walker->mutex);
+}
+
+Dir_node *walker_pop(Walker *walker, int wait) {
+    pthread_mutex_lock(&walker->mutex);
+    while (wait && walker->stack_len == 0 && !walker->stop) {
+        pthread_cond_wait(&walker->cond, &walker->mutex);
+    }
+    Dir_node *node = walker->stack_len > 0 ? walker->stack[--walker->stack_len] : NULL;
+    pthread_mutex_unlock(&walker->mutex);
+    return node;
+}
+
+static void walker_finish(Walker *walker) {
+    pthread_mutex_lock(&walker->mutex);
+    if (--walker->active == 0) {
+        pthread_cond_broadcast(&walker->idle);
+    }
+    pthread_mutex_unlock(&walker->mutex);
+}
+
+static void walker_emit(Walker *walker, Dir_node *node) {
+    pthread_mutex_lock(&walker->emit_mutex);
+    node->done = 1;
+
+    while (walker->cursor && walker->cursor->done) {
+        Dir_node *current = walker->cursor;
+        if (current->out.spill) {
+            writer_copy_spill(&walker->writer, current->out.spill);
+            current->out.spill = NULL;
+        }
+        writer_write(&walker->writer, current->out.data, current->out.len);
+        free(current->out.data);
+        current->out.data = NULL;
+        if (walker->snapshot_writer && current->listed) {
+            snapshot_writer_add(walker->snapshot_writer, current->path, current->mtime_ns, current->ino, &current->snap);
+        }
+
+        if (current->child_count > 0) {
+            walker->cursor = current->children[0];
+            continue;
+        }
+
+        walker->cursor = NULL;
+        while (current) {
+            Dir_node *parent = current->parent;
+            size_t next = current->index + 1;
+            dir_node_free(current);
+            if (parent && next < parent->child_count) {
+                walker->cursor = parent->children[next];
+                break;
+            }
+            current = parent;
+        }
+    }
+    pthread_mutex_unlock(&walker->emit_mutex);
+}
+
+typedef struct {
+    char *dir_buffer;
+    Sorter sorter;
+    Stats stats;
+} Worker_state;
+
+typedef struct {
+    Walker *walker;
+    Dir_node *node;
+} Entry_ctx;
+
+void format_entry(Walker *walker, Dir_node *node, uint64_t ino, const char *name, size_t name_len, mode_t mode) {
+    Text_buffer *out = &node->out;
+    size_t path_len = strlen(node->path);
+
+    switch (walker->format) {
+        case FORMAT_TEXT:
+            text_pad(out, text_u64(out, ino), 10);
+            text_char(out, ' ');
+            text_bytes(out, name, name_len);
+            text_pad(out, name_len, 30);
+            text_char(out, ' ');
+            text_str(out, get_file_type(mode));
+            text_char(out, '\n');
+            break;
+        case FORMAT_NUL:
+            text_u64(out, ino);
+            text_char(out, '\t');
+            text_str(out, get_type_code(mode));
+            text_char(out, '\t');
+            text_bytes(out, node->path, path_len);
+            text_char(out, '/');
+            text_bytes(out, name, name_len);
+            text_char(out, '\0');
+            break;
+        case FORMAT_JSON:
+            text_str(out, "{\"dir\":");
+            text_json_string(out, node->path, path_len);
+            text_str(out, ",\"name\":");
+            text_json_string(out, name, name_len);
+            text_str(out, ",\"ino\":");
+            text_u64(out, ino);
+            text_str(out, ",\"type\":\"");
+            text_str(out, get_type_code(mode));
+            text_str(out, "\"}\n");
+            break;
+        default: {
+            uint8_t type = IFTODT(mode);
+            uint32_t len = path_len + 1 + name_len;
+            text_bytes(out, &ino, sizeof(ino));
+            text_bytes(out, &type, sizeof(type));
+            text_bytes(out, &len, sizeof(len));
+            text_bytes(out, node->path, path_len);
+            text_char(out, '/');
+            text_bytes(out, name, name_len);
+            break;
+        }
+    }
+}
+
+static void walker_add_child(Dir_node *node, const char *name) {
+    Dir_node *child = dir_node_create(node, name);
+    if (!child || dir_node_add_child(node, child) != 0) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        exit(1);
+    }
+}
+
+static void walker_entry(Walker *walker, Dir_node *node, uint64_t ino, const char *name, size_t name_len,
+                         mode_t mode, int descend) {
+    format_entry(walker, node, ino, name, name_len, mode);
+    if (descend) walker_add_child(node, name);
+}
+
+static void diff_line(Dir_node *node, char kind, const char *name, size_t name_len) {
+    text_char(&node->out, kind);
+    text_char(&node->out, ' ');
+    text_str(&node->out, node->path);
+    text_char(&node->out, '/');
+    text_bytes(&node->out, name, name_len);
+    text_char(&node->out, '\n');
+}
+
+static int snap_entry_changed(const Snap_entry *old, const Snap_entry *live) {
+    return old->type != live->type || old->ino != live->ino ||
+           (live->type != DT_DIR && old->mtime_ns != live->mtime_ns);
+}
+
+void diff_report(Walker *walker, Dir_node *node, const Snap_dir *old) {
+    const Snap_list *live = &node->snap;
+    const Snap_entry *old_entries = NULL;
+    const char *old_names = NULL;
+    size_t old_count = 0;
+    if (old) {
+        old_entries = (const Snap_entry *)(walker->snapshot->data + old->entries_offset);
+        old_names = (const char *)walker->snapshot->data + old->names_offset;
+        old_count = old->entry_count;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < old_count || j < live->count) {
+        const Snap_entry *a = i < old_count ? &old_entries[i] : NULL;
+        const Snap_entry *b = j < live->count ? &live->entries[j] : NULL;
+        int result = !a ? 1 : !b ? -1 : name_compare(old_names + a->name_offset, a->name_len,
+                                                      live->names + b->name_offset, b->name_len);
+        if (result < 0) {
+            diff_line(node, '-', old_names + a->name_offset, a->name_len);
+            i++;
+        } else if (result > 0) {
+            diff_line(node, '+', live->names + b->name_offset, b->name_len);
+            j++;
+        } else {
+            if (snap_entry_changed(a, b)) {
+                diff_line(node, '~', live->names + b->name_offset, b->name_len);
+            }
+            i++;
+            j++;
+        }
+    }
+}
+
+static void walker_sorted_entry(void *arg, const Sort_record *record) {
+    Entry_ctx *ctx = (Entry_ctx *)arg;
+    walker_entry(ctx->walker, ctx->node, record->ino, record->name, record->name_len, record->mode, record->descend);
+}
+
+static void walker_schedule_children(Walker *walker, Dir_node *node, int fd) {
+    if (node->child_count == 0) {
+        close(fd);
+    } else {
+        node->fd = fd;
+        node->pending = node->child_count;
+        for (size_t i = node->child_count; i > 0; i--) {
+            walker_push(walker, node->children[i - 1]);
+        }
+    }
+    walker_emit(walker, node);
+}
+
+static int read_snap_entries(Walker *walker, Dir_node *node, int fd, Worker_state *state) {
+    Dir_reader reader;
+    Linux_dirent64 *entry;
+    int status;
+    unsigned long entries = 0;
+    dir_reader_init(&reader, fd, state->dir_buffer, walker->buffer_size);
+    while ((status = dir_reader_next(&reader, &entry)) > 0) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        struct statx file_stat;
+        if (statx(fd, entry->d_name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO | STATX_MTIME, &file_stat) == -1) {
+            fprintf(stderr, "Ошибка получения информации о '%s/%s'\n", node->path, entry->d_name);
+            continue;
+        }
+        entries++;
+        snap_list_add(&node->snap, file_stat.stx_ino,
+                      (int64_t)file_stat.stx_mtime.tv_sec * 1000000000 + file_stat.stx_mtime.tv_nsec,
+                      IFTODT(file_stat.stx_mode), entry->d_name, strlen(entry->d_name));
+    }
+    __atomic_add_fetch(&walker->entries, entries, __ATOMIC_RELAXED);
+
+    snap_list_sort(&node->snap);
+    for (size_t i = 0; i < node->snap.count; i++) {
+        if (node->snap.entries[i].type == DT_DIR) {
+            walker_add_child(node, node->snap.names + node->snap.entries[i].name_offset);
+        }
+    }
+    return status;
+}
+
+static void process_snapshot(Walker *walker, Dir_node *node, int fd, Worker_state *state) {
+    if (walker->mode == MODE_DIFF) {
+        const Snap_dir *old = snapshot_find(walker->snapshot, node->path);
+        if (old && old->mtime_ns == node->mtime_ns && old->ino == (uint64_t)node->ino) {
+            const Snap_entry *old_entries = (const Snap_entry *)(walker->snapshot->data + old->entries_offset);
+            const char *old_names = (const char *)walker->snapshot->data + old->names_offset;
+            for (uint32_t i = 0; i < old->entry_count; i++) {
+                if (old_entries[i].type == DT_DIR) {
+                    walker_add_child(node, old_names + old_entries[i].name_offset);
+                }
+            }
+            __atomic_add_fetch(&walker->dirs_skipped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (read_snap_entries(walker, node, fd, state) == -1) {
+            fprintf(stderr, "Ошибка чтения каталога '%s'\n", node->path);
+        }
+        diff_report(walker, node, old);
+        return;
+    }
+
+    if (read_snap_entries(walker, node, fd, state) == -1) {
+        fprintf(stderr, "Ошибка чтения каталога '%s'\n", node->path);
+    }
+    node->listed = 1;
+}
+
+void walker_process(Walker *walker, Dir_node *node, Worker_state *state) {
+    if (walker->mode == MODE_LIST && walker->format == FORMAT_TEXT) {
+        text_str(&node->out, "Содержимое каталога '");
+        text_str(&node->out, node->path);
+        text_str(&node->out, "':\n");
+    }
+
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    int fd;
+    if (node->parent) {
+        fd = openat(node->parent->fd, node->name, flags | (walker->follow_links ? 0 : O_NOFOLLOW));
+        dir_node_release_fd(node->parent);
+    } else {
+        fd = open(node->path, flags);
+    }
+
+    if (fd == -1) {
+        fprintf(stderr, "Ошибка открытия каталога '%s'\n", node->path);
+        if (walker->mode == MODE_LIST && walker->format == FORMAT_TEXT) text_char(&node->out, '\n');
+        walker_emit(walker, node);
+        return;
+    }
+
+    struct stat dir_stat;
+    if (walker->recursive && fstat(fd, &dir_stat) == 0) {
+        if (node->parent && is_ancestor(node->parent, dir_stat.st_dev, dir_stat.st_ino)) {
+            fprintf(stderr, "Обнаружен цикл: '%s'\n", node->path);
+            close(fd);
+            node->out.len = 0;
+            walker_emit(walker, node);
+            return;
+        }
+        node->dev = dir_stat.st_dev;
+        node->ino = dir_stat.st_ino;
+        node->mtime_ns = (int64_t)dir_stat.st_mtim.tv_sec * 1000000000 + dir_stat.st_mtim.tv_nsec;
+    }
+
+    if (walker->mode == MODE_SNAPSHOT || walker->mode == MODE_DIFF) {
+        process_snapshot(walker, node, fd, state);
+        walker_schedule_children(walker, node, fd);
+        return;
+    }
+
+    unsigned long entries = 0;
+    unsigned long stats_avoided = 0;
+    Dir_reader reader;
+    Linux_dirent64 *entry;
+    int status;
+    dir_reader_init(&reader, fd, state->dir_buffer, walker->buffer_size);
+    while ((status = dir_reader_next(&reader, &entry)) > 0) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
 
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", dirpath, entry->d_name);
+        entries++;
+        mode_t mode = dtype_to_mode(entry->d_type);
+        int is_link = entry->d_type == DT_LNK;
+        struct statx file_stat;
+        if (mode == 0 && entry->d_type == DT_UNKNOWN) {
+            if (statx(fd, entry->d_name, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &file_stat) == -1) {
+                fprintf(stderr, "Ошибка получения информации о '%s/%s'\n", node->path, entry->d_name);
+                continue;
+            }
+            mode = file_stat.stx_mode;
+            is_link = S_ISLNK(mode);
+        }
+        if (is_link) {
+            if (statx(fd, entry->d_name, 0, STATX_TYPE, &file_stat) == -1) {
+                fprintf(stderr, "Ошибка получения информации о '%s/%s'\n", node->path, entry->d_name);
+                continue;
+            }
+            mode = file_stat.stx_mode;
+        }
+        if (entry->d_type != DT_UNKNOWN && !is_link) {
+            stats_avoided++;
+        }
 
-        if (stat(fullpath, &file_stat) == -1) {
-            fprintf(stderr, "Ошибка получения информации о '%s'\n", fullpath);
+        int descend = walker->recursive && S_ISDIR(mode) && (!is_link || walker->follow_links);
+        if (walker->mode == MODE_STATS) {
+            if (statx(fd, entry->d_name, is_link ? 0 : AT_SYMLINK_NOFOLLOW, STATX_SIZE, &file_stat) == -1) {
+                fprintf(stderr, "Ошибка получения информации о '%s/%s'\n", node->path, entry->d_name);
+                continue;
+            }
+            stats_entry(&state->stats, node->path, entry->d_name, mode, file_stat.stx_size);
+            if (descend) walker_add_child(node, entry->d_name);
             continue;
         }
+        size_t name_len = strlen(entry->d_name);
+        if (walker->sort_key != SORT_NONE) {
+            sorter_add(&state->sorter, entry->d_ino, mode, entry->d_name, name_len, descend);
+        } else {
+            walker_entry(walker, node, entry->d_ino, entry->d_name, name_len, mode, descend);
+        }
+    }
+    if (walker->mode == MODE_STATS) {
+        stats_directory(&state->stats, node->depth, entries);
+    } else if (walker->sort_key != SORT_NONE) {
+        Entry_ctx ctx = { walker, node };
+        sorter_finish(&state->sorter, walker_sorted_entry, &ctx);
+    }
+    __atomic_add_fetch(&walker->entries, entries, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&walker->stats_avoided, stats_avoided, __ATOMIC_RELAXED);
+
+    if (status == -1) {
+        fprintf(stderr, "Ошибка чтения каталога '%s'\n", node->path);
+    }
+    if (walker->mode == MODE_LIST && walker->format == FORMAT_TEXT) text_char(&node->out, '\n');
+    walker_schedule_children(walker, node, fd);
+}
+
+char *dir_buffer_create(size_t size) {
+    char *buffer = malloc(size);
+    if (!buffer) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        exit(1);
+    }
+    return buffer;
+}
+
+void worker_state_init(Worker_state *state, const Walker *walker) {
+    memset(state, 0, sizeof(*state));
+    state->dir_buffer = dir_buffer_create(walker->buffer_size);
+    state->sorter.key = walker->sort_key;
+    state->sorter.limit = walker->sort_memory;
+    if (walker->mode == MODE_STATS) stats_init(&state->stats, walker->stats.top_limit);
+}
+
+void worker_state_free(Worker_state *state, Walker *walker) {
+    free(state->dir_buffer);
+    sorter_free(&state->sorter);
+    if (walker->mode == MODE_STATS) {
+        pthread_mutex_lock(&walker->mutex);
+        stats_merge(&walker->stats, &state->stats);
+        pthread_mutex_unlock(&walker->mutex);
+    }
+}
+
+static void *walker_thread(void *arg) {
+    Walker *walker = (Walker *)arg;
+    Worker_state state;
+    worker_state_init(&state, walker);
+    Dir_node *node;
+    while ((node = walker_pop(walker, 1)) != NULL) {
+        walker_process(walker, node, &state);
+        walker_finish(walker);
+    }
+    worker_state_free(&state, walker);
+    return NULL;
+}
+
+void my_ls(Walker *walker, const char *dirpath, int threaded) {
+    Dir_node *root = dir_node_create(NULL, dirpath);
+    if (!root) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        return;
+    }
+    walker->cursor = root;
+    walker_push(walker, root);
+
+    if (!threaded) {
+        Worker_state state;
+        worker_state_init(&state, walker);
+        Dir_node *node;
+        while ((node = walker_pop(walker, 0)) != NULL) {
+            walker_process(walker, node, &state);
+            walker_finish(walker);
+        }
+        worker_state_free(&state, walker);
+        return;
+    }
+
+    pthread_mutex_lock(&walker->mutex);
+    while (walker->active > 0) {
+        pthread_cond_wait(&walker->idle, &walker->mutex);
+    }
+    pthread_mutex_unlock(&walker->mutex);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int bench_directory(const char *dirpath, size_t buffer_size, int rounds) {
+    char *buffer = dir_buffer_create(buffer_size);
+    double readdir_ms = 0, getdents_ms = 0;
+    unsigned long readdir_entries = 0, getdents_entries = 0, calls = 0;
+
+    for (int round = 0; round < rounds; round++) {
+        double start = now_ms();
+        DIR *dir = opendir(dirpath);
+        if (dir == NULL) {
+            fprintf(stderr, "Ошибка открытия каталога '%s'\n", dirpath);
+            free(buffer);
+            return -1;
+        }
+        readdir_entries = 0;
+        while (readdir(dir) != NULL) {
+            readdir_entries++;
+        }
+        closedir(dir);
+        readdir_ms += now_ms() - start;
+
+        start = now_ms();
+        int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "Ошибка открытия каталога '%s'\n", dirpath);
+            free(buffer);
+            return -1;
+        }
+        Dir_reader reader;
+        Linux_dirent64 *entry;
+        dir_reader_init(&reader, fd, buffer, buffer_size);
+        getdents_entries = 0;
+        while (dir_reader_next(&reader, &entry) > 0) {
+            getdents_entries++;
+        }
+        calls = reader.calls;
+        close(fd);
+        getdents_ms += now_ms() - start;
+    }
 
-        printf("%-10lu %-30s %s\n", (unsigned long)entry->d_ino, entry->d_name, get_file_type(file_stat.st_mode));
+    printf("Каталог '%s': %lu записей, %d проходов\n", dirpath, getdents_entries, rounds);
+    printf("  readdir:                 %10.3f мс на проход\n", readdir_ms / rounds);
+    printf("  getdents64 (%6zu КБ): %10.3f мс на проход, %lu вызовов\n",
+           buffer_size >> 10, getdents_ms / rounds, calls);
+    if (readdir_entries != getdents_entries) {
+        fprintf(stderr, "Число записей не совпадает: readdir %lu, getdents64 %lu\n",
+                readdir_entries, getdents_entries);
     }
+    free(buffer);
+    return 0;
+}
 
-    if (closedir(dir) == -1) {
-        fprintf(stderr, "Ошибка закрытия каталога '%s'\n", dirpath);
+static void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
     }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Использование: %s <путь к каталогу>\n", argv[0]);
+    Walker walker = {0};
+    walker.buffer_size = DIR_BUFFER_DEFAULT;
+    walker.sort_memory = SORT_MEMORY_DEFAULT;
+    int bench_rounds = 0;
+    const char *snapshot_path = NULL;
+    size_t top_limit = STATS_TOP_DEFAULT;
+    int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0) thread_count = 1;
+
+    static const struct option long_options[] = {
+        { "buffer", required_argument, NULL, 'b' },
+        { "bench", optional_argument, NULL, 'B' },
+        { "format", required_argument, NULL, 'F' },
+        { "sort", required_argument, NULL, 'S' },
+        { "sort-mem", required_argument, NULL, 'M' },
+        { "snapshot", required_argument, NULL, 'P' },
+        { "diff", required_argument, NULL, 'D' },
+        { "stats", no_argument, NULL, 'T' },
+        { "top", required_argument, NULL, 'N' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "RLvj:b:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'R':
+                walker.recursive = 1;
+                break;
+            case 'L':
+                walker.follow_links = 1;
+                break;
+            case 'v':
+                walker.verbose = 1;
+                break;
+            case 'b':
+                walker.buffer_size = strtoul(optarg, NULL, 0) << 10;
+                if (walker.buffer_size < DIR_BUFFER_MIN) {
+                    fprintf(stderr, "Размер буфера должен быть не меньше %d КБ\n", DIR_BUFFER_MIN >> 10);
+                    return 1;
+                }
+                break;
+            case 'F':
+                if (strcmp(optarg, "text") == 0) walker.format = FORMAT_TEXT;
+                else if (strcmp(optarg, "nul") == 0) walker.format = FORMAT_NUL;
+                else if (strcmp(optarg, "json") == 0) walker.format = FORMAT_JSON;
+                else if (strcmp(optarg, "bin") == 0) walker.format = FORMAT_BIN;
+                else {
+                    fprintf(stderr, "Неизвестный формат вывода %s (text, nul, json, bin)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                if (strcmp(optarg, "name") == 0) walker.sort_key = SORT_NAME;
+                else if (strcmp(optarg, "inode") == 0) walker.sort_key = SORT_INODE;
+                else {
+                    fprintf(stderr, "Неизвестный ключ сортировки %s (name, inode)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'M':
+                walker.sort_memory = strtoul(optarg, NULL, 0) << 20;
+                if (walker.sort_memory == 0) {
+                    fprintf(stderr, "Объём памяти для сортировки должен быть положительным\n");
+                    return 1;
+                }
+                break;
+            case 'P':
+            case 'D':
+                walker.mode = opt == 'P' ? MODE_SNAPSHOT : MODE_DIFF;
+                walker.recursive = 1;
+                snapshot_path = optarg;
+                break;
+            case 'T':
+                walker.mode = MODE_STATS;
+                break;
+            case 'N': {
+                char *end;
+                top_limit = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Некорректное число файлов: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'B':
+                bench_rounds = optarg ? atoi(optarg) : 5;
+                if (bench_rounds <= 0) {
+                    fprintf(stderr, "Число проходов должно быть положительным\n");
+                    return 1;
+                }
+                break;
+            case 'j':
+                thread_count = atoi(optarg);
+                if (thread_count <= 0) {
+                    fprintf(stderr, "Число потоков должно быть положительным\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        printf("Использование: %s [-v] [-R [-L] [-j потоки]] [-b буфер-КБ] [--format text|nul|json|bin]\n"
+               "               [--sort name|inode [--sort-mem МБ]] <путь к каталогу>...\n"
+               "               %s [-j потоки] --snapshot файл | --diff файл <путь к каталогу>...\n"
+               "               %s [-R [-L] [-j потоки]] --stats [--top N] [--format text|json] <путь к каталогу>...\n"
+               "               %s --bench[=проходы] [-b буфер-КБ] <путь к каталогу>...\n", argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
-    for (int i = 1; i < argc; i++) {
+    if (bench_rounds > 0) {
+        int status = 0;
+        for (int i = optind; i < argc; i++) {
+            if (bench_directory(argv[i], walker.buffer_size, bench_rounds) != 0) status = 1;
+        }
+        return status;
+    }
+
+    if (walker.mode == MODE_SNAPSHOT) {
+        walker.snapshot_writer = snapshot_writer_open(snapshot_path);
+        if (!walker.snapshot_writer) {
+            fprintf(stderr, "Ошибка создания снимка '%s'\n", snapshot_path);
+            return 1;
+        }
+    } else if (walker.mode == MODE_STATS) {
+        stats_init(&walker.stats, top_limit);
+    } else if (walker.mode == MODE_DIFF) {
+        walker.snapshot = snapshot_open(snapshot_path);
+        if (!walker.snapshot) {
+            fprintf(stderr, "Ошибка чтения снимка '%s'\n", snapshot_path);
+            return 1;
+        }
+    }
+
+    walker.writer.fd = STDOUT_FILENO;
+    walker.writer.capacity = OUT_WRITER_SIZE;
+    walker.writer.data = malloc(OUT_WRITER_SIZE);
+    if (!walker.writer.data) {
+        fprintf(stderr, "Ошибка выделения памяти\n");
+        return 1;
+    }
+
+    pthread_mutex_init(&walker.mutex, NULL);
+    pthread_mutex_init(&walker.emit_mutex, NULL);
+    pthread_cond_init(&walker.cond, NULL);
+    pthread_cond_init(&walker.idle, NULL);
+
+    int threaded = walker.recursive && thread_count > 1;
+    pthread_t *threads = NULL;
+    if (walker.recursive) {
+        raise_fd_limit();
+    }
+    if (threaded) {
+        threads = malloc(thread_count * sizeof(pthread_t));
+        if (!threads) {
+            fprintf(stderr, "Ошибка выделения памяти\n");
+            return 1;
+        }
+        for (int i = 0; i < thread_count; i++) {
+            if (pthread_create(&threads[i], NULL, walker_thread, &walker) != 0) {
+                fprintf(stderr, "Ошибка создания потока\n");
+                return 1;
+            }
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
         struct stat path_stat;
-        
+
         if (stat(argv[i], &path_stat) == -1) {
             fprintf(stderr, "Ошибка доступа к '%s'\n", argv[i]);
             continue;
@@ -69,10 +1789,44 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "'%s' не является каталогом\n", argv[i]);
             continue;
         }
-        printf("Содержимое каталога '%s':\n", argv[i]);
-        my_ls(argv[i]);
-        printf("\n");
+        my_ls(&walker, argv[i], threaded);
     }
 
-    return 0;
-}
\ No newline at end of file
+    if (threaded) {
+        pthread_mutex_lock(&walker.mutex);
+        walker.stop = 1;
+        pthread_cond_broadcast(&walker.cond);
+        pthread_mutex_unlock(&walker.mutex);
+        for (int i = 0; i < thread_count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    writer_flush(&walker.writer);
+    free(walker.writer.data);
+
+    int exit_status = 0;
+    if (walker.snapshot_writer && snapshot_writer_finish(walker.snapshot_writer) != 0) {
+        exit_status = 1;
+    }
+    snapshot_close(walker.snapshot);
+    if (walker.mode == MODE_STATS) {
+        stats_print(&walker.stats, walker.format);
+        stats_free(&walker.stats);
+    }
+
+    if (walker.verbose) {
+        fprintf(stderr, "Вызовов stat сэкономлено: %lu из %lu\n", walker.stats_avoided, walker.entries);
+        if (walker.mode == MODE_DIFF) {
+            fprintf(stderr, "Каталогов без изменений пропущено: %lu\n", walker.dirs_skipped);
+        }
+    }
+
+    free(walker.stack);
+    pthread_mutex_destroy(&walker.mutex);
+    pthread_mutex_destroy(&walker.emit_mutex);
+    pthread_cond_destroy(&walker.cond);
+    pthread_cond_destroy(&walker.idle);
+    return exit_status;
+}